@@ -0,0 +1,162 @@
+/* arena.c: region allocation for state freed all at once.
+ *
+ * An arena hands out memory from blocks of ARENA_BLOCK bytes, bumping a
+ * pointer, so many small objects of the same lifetime cost neither a
+ * malloc each nor headers and holes between them.  There is no free of
+ * a single object: arena_reset() drops all of them, keeping one block
+ * for the next round, and arena_release() gives everything back.  An
+ * object bigger than a quarter block gets a block of its own.
+ *
+ * Arenas are not locked, the code owning one does that.  Every arena is
+ * registered on first use, with its name, so memory_usage() can report
+ * them all.  Tables allocated by hand are counted the same way, with
+ * arena_count(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tv_grab_dvb.h"
+
+#define ARENA_BLOCK (64 << 10)
+#define ARENA_ALIGN 16
+
+struct arena_block {
+  struct arena_block *next; // the one before
+  size_t size, used;        // of data
+  char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static struct arena *arenas;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void arena_register(struct arena *a) {
+  pthread_mutex_lock(&lock);
+  if (!a->registered) {
+    a->next = arenas;
+    arenas = a;
+    a->registered = true;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/* Counters are read by other threads, without the owner's lock. */
+static inline void add(size_t *counter, size_t n) {
+  __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+static struct arena_block *block_new(struct arena *a, size_t size) {
+  struct arena_block *b = malloc(sizeof(*b) + size);
+  if (b == NULL) {
+    fprintf(stderr, "Out of memory for %s\n", a->name);
+    exit(1);
+  }
+  if (!a->registered)
+    arena_register(a);
+  b->size = size;
+  b->used = 0;
+  add(&a->reserved, sizeof(*b) + size);
+  return b;
+}
+
+/* Get n bytes, aligned for any type. {{{ */
+void *arena_alloc(struct arena *a, size_t n) {
+  struct arena_block *b = a->block;
+  n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (n > ARENA_BLOCK / 4) {
+    /* a block of its own, behind the current one which stays in use */
+    struct arena_block *big = block_new(a, n);
+    if (b) {
+      big->next = b->next;
+      b->next = big;
+    } else {
+      big->next = NULL;
+      a->block = big;
+    }
+    big->used = n;
+    add(&a->used, n);
+    return big->data;
+  }
+  if (b == NULL || b->size - b->used < n) {
+    b = block_new(a, ARENA_BLOCK);
+    b->next = a->block;
+    a->block = b;
+  }
+  void *p = b->data + b->used;
+  b->used += n;
+  add(&a->used, n);
+  return p;
+} /*}}}*/
+
+void *arena_copy(struct arena *a, const void *data, size_t n) {
+  return memcpy(arena_alloc(a, n), data, n);
+}
+
+/* Drop everything allocated, keeping the current block. {{{ */
+void arena_reset(struct arena *a) {
+  struct arena_block *b = a->block, *next;
+  if (b == NULL)
+    return;
+  for (next = b->next; next; next = b->next) {
+    b->next = next->next;
+    add(&a->reserved, -(sizeof(*next) + next->size));
+    free(next);
+  }
+  if (b->size != ARENA_BLOCK) { // a big one, of no use for the next round
+    add(&a->reserved, -(sizeof(*b) + b->size));
+    free(b);
+    a->block = NULL;
+  } else
+    b->used = 0;
+  __atomic_store_n(&a->used, 0, __ATOMIC_RELAXED);
+} /*}}}*/
+
+/* Give all blocks back. */
+void arena_release(struct arena *a) {
+  arena_reset(a);
+  if (a->block) {
+    add(&a->reserved, -(sizeof(*a->block) + a->block->size));
+    free(a->block);
+    a->block = NULL;
+  }
+}
+
+/* Exchange the blocks of two arenas, say after copying what is to be
+ * kept from one to the other.  Names and registration stay. */
+void arena_swap(struct arena *a, struct arena *b) {
+  struct arena_block *block = a->block;
+  size_t used = a->used, reserved = a->reserved;
+  a->block = b->block;
+  b->block = block;
+  __atomic_store_n(&a->used, b->used, __ATOMIC_RELAXED);
+  __atomic_store_n(&a->reserved, b->reserved, __ATOMIC_RELAXED);
+  __atomic_store_n(&b->used, used, __ATOMIC_RELAXED);
+  __atomic_store_n(&b->reserved, reserved, __ATOMIC_RELAXED);
+  if (a->block && !a->registered)
+    arena_register(a);
+  if (b->block && !b->registered)
+    arena_register(b);
+}
+
+/* Count a table allocated elsewhere, of which used bytes are in use. */
+void arena_count(struct arena *a, size_t used, size_t reserved) {
+  if (!a->registered)
+    arena_register(a);
+  __atomic_store_n(&a->used, used, __ATOMIC_RELAXED);
+  __atomic_store_n(&a->reserved, reserved, __ATOMIC_RELAXED);
+}
+
+/* Pass the counters of every arena to fn, in order of first use. {{{ */
+void memory_usage(void (*fn)(const char *name, size_t used, size_t reserved, void *arg), void *arg) {
+  struct arena *v[64], *a;
+  int n = 0;
+  pthread_mutex_lock(&lock);
+  for (a = arenas; a && n < 64; a = a->next)
+    v[n++] = a;
+  pthread_mutex_unlock(&lock);
+  while (n-- > 0)
+    fn(v[n]->name, __atomic_load_n(&v[n]->used, __ATOMIC_RELAXED),
+        __atomic_load_n(&v[n]->reserved, __ATOMIC_RELAXED), arg);
+} /*}}}*/
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""mkcapture.py: EIT sections for the XMLTV of samples/, for bench/run.sh.
+
+There are no recordings of the broadcasts the samples were made from, so
+this builds the sections back from them: every programme becomes an
+event of EIT schedule actual, with a short event descriptor for the title
+and sub-title, extended event descriptors for the desc, a component
+descriptor each for the video and audio, and a parental rating
+descriptor.  Text is UTF-16BE (character table 0x14) like the Taiwanese
+broadcasters send, or UTF-8 (0x15) where that is shorter, so both native
+decoders of dvb_text_iconv.c get used.  Read back with -d, and TZ set to
+the zone of the samples, epgrab writes the programmes of the sample again.
+
+There is no SDT, so the programmes are written as they come instead of
+held back for the channel list, which stays empty like in the samples.
+
+The events of one service for a run of consecutive programmes share a
+section, so they come out in the order of the sample.  With --repeat N
+the capture is repeated N times, each with the next version_number, as
+an updated schedule; read back with -u that decodes everything N times.
+
+usage: mkcapture.py [--repeat N] sample.xml capture.sec
+"""
+import calendar
+import sys
+import time
+import xml.etree.ElementTree as ET
+
+ONID = 0x2001          # original_network_id of all services
+TSID = 1
+LANG = b"chi"          # zh in iso_639.tab
+SECTION_MAX = 4096 - 3 - 4 - 11  # event bytes in a section after header and CRC
+
+ASPECTS = {"4:3": 0x01, "16:9": 0x03, "2.21:1": 0x04}   # (component_type - 1) & 3
+AUDIO = {"mono": 0x01, "stereo": 0x03, "x-multilingual": 0x04, "surround": 0x05}
+
+
+def crc32(data):
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            crc = (crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1
+            crc &= 0xFFFFFFFF
+    return crc
+
+
+def dvb_text(s):
+    """s as a DVB string, with the shorter of the two character tables."""
+    if not s:
+        return b""
+    utf8 = b"\x15" + s.encode("utf-8")
+    utf16 = b"\x14" + s.encode("utf-16-be")
+    return utf16 if len(utf16) < len(utf8) else utf8
+
+
+def chunks(s, size):
+    """s cut into DVB strings of at most size bytes, at character ends."""
+    out, part = [], ""
+    for c in s:
+        if part and len(dvb_text(part + c)) > size:
+            out.append(dvb_text(part))
+            part = ""
+        part += c
+    if part:
+        out.append(dvb_text(part))
+    return out
+
+
+def bcd(n):
+    return (n // 10) << 4 | n % 10
+
+
+def utc(stamp):
+    """An XMLTV time such as 20130705220000 +0800 as seconds since 1970."""
+    t, zone = stamp.split()
+    sign = -1 if zone[0] == "-" else 1
+    offset = sign * (int(zone[1:3]) * 3600 + int(zone[3:5]) * 60)
+    return calendar.timegm(time.strptime(t, "%Y%m%d%H%M%S")) - offset
+
+
+def descriptor(tag, body):
+    if len(body) > 255:
+        raise ValueError("descriptor 0x%02x too long" % tag)
+    return bytes([tag, len(body)]) + body
+
+
+def descriptors(p):
+    title = dvb_text(p.findtext("title") or "")
+    sub_title = dvb_text(p.findtext("sub-title") or "")
+    out = descriptor(0x4D, LANG + bytes([len(title)]) + title +
+                     bytes([len(sub_title)]) + sub_title)
+    desc = p.findtext("desc")
+    if desc:
+        parts = chunks(desc, 255 - 6)
+        for i, text in enumerate(parts):
+            out += descriptor(0x4E, bytes([i << 4 | (len(parts) - 1)]) + LANG +
+                              b"\x00" + bytes([len(text)]) + text)
+    aspect = p.findtext("video/aspect")
+    if aspect:
+        out += descriptor(0x50, bytes([0xF1, ASPECTS[aspect], 0]) + LANG)
+    stereo = p.findtext("audio/stereo")
+    if stereo:
+        out += descriptor(0x50, bytes([0xF2, AUDIO[stereo], 0]) + LANG)
+    age = p.findtext("rating/value")
+    if age:
+        out += descriptor(0x55, b"TWN" + bytes([int(age) - 3]))
+    return out
+
+
+def event(eid, p):
+    start = utc(p.get("start"))
+    duration = utc(p.get("stop")) - start
+    d = descriptors(p)
+    day, secs = divmod(start, 86400)
+    mjd = day + 40587
+    return bytes([
+        eid >> 8, eid & 0xFF, mjd >> 8, mjd & 0xFF,
+        bcd(secs // 3600), bcd(secs // 60 % 60), bcd(secs % 60),
+        bcd(duration // 3600), bcd(duration // 60 % 60), bcd(duration % 60),
+        len(d) >> 8, len(d) & 0xFF]) + d
+
+
+def sections(root):
+    """(sid, events) of every section, in the order of the programmes."""
+    out, eids = [], {}
+    for p in root.iter("programme"):
+        sid = int(p.get("channel").split(".")[0])
+        eids[sid] = eids.get(sid, 0) + 1
+        ev = event(eids[sid], p)
+        if not out or out[-1][0] != sid or len(out[-1][1]) + len(ev) > SECTION_MAX:
+            out.append((sid, b""))
+        out[-1] = (sid, out[-1][1] + ev)
+    return out
+
+
+def capture(secs, version):
+    """The sections with their numbers, 256 to each table_id from 0x50."""
+    total, number = {}, {}
+    for sid, _ in secs:
+        total[sid] = total.get(sid, 0) + 1
+    out = b""
+    for sid, events in secs:
+        n = number.get(sid, 0)
+        number[sid] = n + 1
+        last_table = 0x50 + (total[sid] - 1) // 256
+        table = 0x50 + n // 256
+        last = 255 if table < last_table else (total[sid] - 1) % 256
+        n %= 256
+        segment_last = min(n | 7, last)
+        body = bytes([
+            sid >> 8, sid & 0xFF, 0xC1 | (version & 0x1F) << 1, n, last,
+            TSID >> 8, TSID & 0xFF, ONID >> 8, ONID & 0xFF,
+            segment_last, last_table]) + events
+        length = len(body) + 4
+        sec = bytes([table, 0xF0 | length >> 8, length & 0xFF]) + body
+        out += sec + crc32(sec).to_bytes(4, "big")
+    return out
+
+
+def main(argv):
+    repeat = 1
+    if len(argv) > 1 and argv[1] == "--repeat":
+        repeat = int(argv[2])
+        argv = argv[:1] + argv[3:]
+    if len(argv) != 3 or not 1 <= repeat <= 32:
+        sys.exit(__doc__.strip().splitlines()[-1])
+    secs = sections(ET.parse(argv[1]).getroot())
+    with open(argv[2], "wb") as f:
+        for version in range(repeat):
+            f.write(capture(secs, version))
+
+
+if __name__ == "__main__":
+    main(sys.argv)
@@ -0,0 +1,40 @@
+#!/bin/sh
+# run.sh EPGRAB CAPTURES SAMPLE...: the bench target.
+#
+# For every sample, the capture CAPTURES/name.sec made by mkcapture.py is
+# read back and the XMLTV compared to samples/name.xml, but for its blank
+# lines.  Then CAPTURES/name.rep.sec, the same repeated as updates, is read
+# RUNS times with --stats, and the figures of the fastest run are shown.
+# EPGRAB_ARGS are passed on, say -j 0 to time without decoder threads.
+# Exits 1 if any output differs from its sample.
+EPGRAB=$1; CAPTURES=$2; shift 2
+RUNS=${RUNS:-5}
+export TZ=Asia/Taipei  # of the samples
+status=0
+
+for sample in "$@"; do
+  name=$(basename "$sample" .xml)
+  out=$CAPTURES/$name.out.xml
+  $EPGRAB -s -d --channels /dev/null $EPGRAB_ARGS -i "$CAPTURES/$name.sec" | grep -v '^$' > "$out"
+  grep -v '^$' "$sample" > "$CAPTURES/$name.golden.xml"
+  if ! diff -u "$CAPTURES/$name.golden.xml" "$out" > "$CAPTURES/$name.diff"; then
+    echo "$name: output differs from $sample"
+    head -20 "$CAPTURES/$name.diff"
+    status=1
+    continue
+  fi
+  best=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    stats=$($EPGRAB -s -d -u --stats --channels /dev/null $EPGRAB_ARGS -i "$CAPTURES/$name.rep.sec" 2>&1 >/dev/null | grep '^St')
+    secs=$(echo "$stats" | sed -n 's/.* in \([0-9.]*\) s:.*/\1/p')
+    if [ -z "$best" ] || [ "$(echo "$secs $best_secs" | awk '{print ($1 < $2)}')" = 1 ]; then
+      best=$stats
+      best_secs=$secs
+    fi
+    i=$((i + 1))
+  done
+  echo "$name: golden ok"
+  echo "$best" | sed 's/^/  /'
+done
+exit $status
@@ -0,0 +1,194 @@
+/* binary.c: programmes as length-prefixed binary records, for loading
+ * without an XML parser, see doc/binary-format.md.
+ *
+ * The records carry the codes of the descriptors as broadcast where
+ * XMLTV has the strings looked up for them, and only the text is
+ * converted, to plain UTF-8.  All numbers are little-endian. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tv_grab_dvb.h"
+
+#define BINARY_VERSION 1
+
+enum record_type { RECORD_PROGRAMME = 1, RECORD_REMOVED, RECORD_CHANNEL };
+
+#define RECORD_HEADER    8   // length, type, reserved, count
+#define PROGRAMME_FIXED  36  // up to the channel id
+
+static void put8(struct strbuf *sb, unsigned v) {
+  uint8_t b = v;
+  strbuf_add(sb, &b, 1);
+}
+
+static void put16(struct strbuf *sb, unsigned v) {
+  uint8_t b[2] = { v, v >> 8 };
+  strbuf_add(sb, b, 2);
+}
+
+static void put64(struct strbuf *sb, int64_t v) {
+  uint8_t b[8];
+  int i;
+  for (i = 0; i < 8; i++)
+    b[i] = (uint64_t)v >> (8 * i);
+  strbuf_add(sb, b, 8);
+}
+
+static void set16(struct strbuf *sb, size_t at, unsigned v) {
+  sb->buf[at] = v;
+  sb->buf[at + 1] = v >> 8;
+}
+
+static void set32(struct strbuf *sb, size_t at, uint32_t v) {
+  int i;
+  for (i = 0; i < 4; i++)
+    sb->buf[at + i] = v >> (8 * i);
+}
+
+/* Start a record, finished by end_record() with its length. {{{ */
+static size_t begin_record(enum record_type type) {
+  size_t mark = output.len;
+  strbuf_add(&output, "\0\0\0\0", 4);
+  put8(&output, type);
+  put8(&output, 0);
+  put16(&output, 0);
+  return mark;
+}
+
+static void end_record(size_t mark, unsigned count) {
+  set32(&output, mark, output.len - mark);
+  set16(&output, mark + 6, count);
+} /*}}}*/
+
+/* A string of converted text, with its 16 bit length in front. {{{ */
+static size_t put_string(const char *s, size_t len) {
+  put16(&output, len);
+  strbuf_add(&output, s, len);
+  return len;
+}
+
+static size_t put_text(const char *s, int len) {
+  size_t at = output.len;
+  put16(&output, 0);
+  int n = dvb_text(&output, s, len);
+  if (n < 0)
+    n = 0; // left empty
+  set16(&output, at, n);
+  return n;
+} /*}}}*/
+
+/* Field header, the text follows. {{{ */
+static void put_field(int type, int code, int code2, const char *lang) {
+  put8(&output, type);
+  put8(&output, code);
+  put8(&output, code2);
+  strbuf_add(&output, lang, 3);
+} /*}}}*/
+
+/* Put one desc together from its parts. {{{
+ * Returns the index of the last field used. */
+static int binary_desc(const struct programme *p, int i) {
+  const struct epgrab_field *f = &p->field[i];
+  put_field(EPGRAB_DESC, 0, 0, f->lang);
+  size_t at = output.len;
+  put16(&output, 0);
+  for (i++; i < p->count && p->field[i].type == EPGRAB_DESC_TEXT; i++) {
+    f = &p->field[i];
+    dvb_text(&output, f->text, f->len);
+    if (f->code)
+      strbuf_add(&output, f->code == ':' ? ": " : "; ", 2);
+  }
+  set16(&output, at, output.len - at - 2);
+  return i < p->count && p->field[i].type == EPGRAB_DESC_END ? i : i - 1;
+} /*}}}*/
+
+/* Write one programme. {{{ */
+static void binary_programme(const struct programme *p) {
+  static const char none[3];
+  size_t mark = begin_record(RECORD_PROGRAMME);
+  unsigned count = 0;
+  int i;
+
+  put16(&output, p->onid);
+  put16(&output, p->tsid);
+  put16(&output, p->sid);
+  put16(&output, p->eid);
+  put64(&output, p->start);
+  put64(&output, p->stop);
+  put8(&output, p->running_status);
+  put8(&output, 0);
+  put_string(p->channel, strlen(p->channel));
+
+  for (i = 0; i < p->count; i++) {
+    const struct epgrab_field *f = &p->field[i];
+    size_t at = output.len;
+    switch (f->type) {
+      case EPGRAB_TITLE:
+      case EPGRAB_SUB_TITLE:
+        put_field(f->type, 0, 0, f->lang);
+        if (put_text(f->text, f->len) == 0 && f->type == EPGRAB_SUB_TITLE) {
+          output.len = at; // nothing left after conversion
+          continue;
+        }
+        break;
+      case EPGRAB_DESC:
+        i = binary_desc(p, i);
+        break;
+      case EPGRAB_CATEGORY:
+        put_field(f->type, f->code, f->code2, none);
+        put16(&output, 0);
+        break;
+      case EPGRAB_COMPONENT:
+      case EPGRAB_RATING:
+        put_field(f->type, f->code, f->code2, f->lang);
+        put16(&output, 0);
+        break;
+      case EPGRAB_CRID:
+        put_field(f->type, f->code, 0, none);
+        put_text(f->text, f->len);
+        break;
+      default: // parts of a desc without its start, unknown descriptors
+        continue;
+    }
+    count++;
+  }
+  end_record(mark, count);
+} /*}}}*/
+
+/* A removal record, the fixed part and channel of the programme. {{{ */
+static void binary_removed(struct strbuf *sb, const char *text, size_t len) {
+  if (len < PROGRAMME_FIXED)
+    return;
+  size_t n = PROGRAMME_FIXED + ((uint8_t)text[34] | (uint8_t)text[35] << 8);
+  if (n > len)
+    return;
+  size_t mark = sb->len;
+  strbuf_add(sb, text, n);
+  set32(sb, mark, n);
+  sb->buf[mark + 4] = RECORD_REMOVED;
+  set16(sb, mark + 6, 0);
+} /*}}}*/
+
+static void binary_head(void) {
+  out_lit("EPGB");
+  put16(&output, BINARY_VERSION);
+  put16(&output, 0);
+}
+
+static void binary_channel(int sid, const char *id, const char *name, int len) {
+  size_t mark = begin_record(RECORD_CHANNEL);
+  put16(&output, sid);
+  put_string(id, strlen(id));
+  put_text(name, len);
+  end_record(mark, 0);
+}
+
+static void binary_tail(void) {
+}
+
+const struct writer binary_writer = {
+  binary_head, binary_channel, binary_programme, binary_removed, binary_tail,
+};
@@ -0,0 +1,457 @@
+/* cache.c: programmes of earlier runs, so unchanged sections need not
+ * be decoded again.
+ *
+ * The cache file is mapped as it is.  It holds a header, an open-
+ * addressing table of sections keyed by (original_network_id,
+ * service_id, table_id, section_number), the events of all those
+ * sections and the output fragments rendered for them:
+ *
+ *   struct cache_header
+ *   struct cache_section [slots]
+ *   struct cache_event   [events]
+ *   struct cache_slot    [event_slots]
+ *   char                 [text]
+ *
+ * The second table finds the fragment of an event by (original_network_id,
+ * service_id, event_id), whichever section it was in, for comparing
+ * programmes of new sections with what was there before.
+ *
+ * A section is only taken from the cache if its CRC_32 and length are
+ * the same, which covers the version and every byte of its events.
+ * Whatever depends on the options is in the fingerprint, a file written
+ * with other ones is ignored.  The file is in host byte order.
+ *
+ * Sections decoded in this run are collected in memory and written out
+ * together with those of the old file they do not replace, unless all
+ * of their events ended long ago. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+#define CACHE_MAGIC   "EPGCACHE"
+#define CACHE_VERSION 3
+#define CACHE_EXPIRED (24 * 60 * 60)  // how long an event is kept after it ended
+
+struct cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t fingerprint;
+  uint32_t slots;         // a power of 2
+  uint32_t events;
+  uint32_t event_slots;   // a power of 2
+  uint32_t pad;
+  uint64_t text;          // bytes
+};
+
+struct cache_section {
+  uint16_t onid;
+  uint16_t sid;
+  uint8_t tid;
+  uint8_t number;
+  uint8_t used;
+  uint8_t pad;
+  uint32_t crc;           // CRC_32 of the section
+  uint32_t len;
+  uint32_t first;         // index of its first event
+  uint32_t count;
+};
+
+struct cache_slot {
+  uint16_t onid;
+  uint16_t sid;
+  uint16_t eid;
+  uint8_t used;
+  uint8_t pad;
+  uint32_t event;         // index into the events
+};
+
+static const char *path;
+static uint32_t fingerprint;
+
+/* the old file */
+static void *map;
+static size_t map_size;
+static const struct cache_header *old;
+static const struct cache_section *old_sections;
+static const struct cache_event *old_events;
+static const struct cache_slot *old_slots;
+static const char *old_text;
+
+/* sections decoded in this run */
+static struct cache_section *new_sections;
+static size_t new_count, new_size;
+static struct cache_event *new_events;
+static size_t new_event_count, new_event_size;
+static struct strbuf new_text = STRBUF_INIT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a, to fold whatever the fingerprint depends on into it. */
+uint32_t cache_hash(uint32_t h, const void *data, size_t len) {
+  const uint8_t *p = data;
+  if (h == 0)
+    h = 2166136261u;
+  while (len--)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+static inline size_t section_hash(uint16_t onid, uint16_t sid, uint8_t tid, uint8_t number) {
+  uint64_t k = ((uint64_t)onid << 32) | ((uint64_t)sid << 16) | (tid << 8) | number;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static inline size_t event_hash(uint16_t onid, uint16_t sid, uint16_t eid) {
+  uint64_t k = ((uint64_t)onid << 32) | ((uint64_t)sid << 16) | eid;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static inline uint32_t section_crc(const uint8_t *sec, size_t len) {
+  const uint8_t *c = sec + len - 4;
+  return (uint32_t)c[0] << 24 | c[1] << 16 | c[2] << 8 | c[3];
+}
+
+/* Map the cache file, if there is one written with the same options. {{{ */
+void cache_open(const char *file, uint32_t fp) {
+  struct stat st;
+  int fd;
+  path = file;
+  fingerprint = fp;
+  if ((fd = open(file, O_RDONLY)) < 0)
+    return;
+  if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct cache_header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+      map = NULL;
+    else
+      map_size = st.st_size;
+  }
+  close(fd);
+  if (map == NULL)
+    return;
+
+  const struct cache_header *h = map;
+  size_t slots = h->slots, events = h->events, event_slots = h->event_slots;
+  if (memcmp(h->magic, CACHE_MAGIC, 8) || h->version != CACHE_VERSION ||
+      h->fingerprint != fp || (slots & (slots - 1)) || (event_slots & (event_slots - 1)) ||
+      sizeof(*h) + slots * sizeof(struct cache_section) + events * sizeof(struct cache_event) +
+      event_slots * sizeof(struct cache_slot) + h->text != map_size) {
+    munmap(map, map_size);
+    map = NULL;
+    return;
+  }
+  old = h;
+  old_sections = (const void *)(h + 1);
+  old_events = (const void *)(old_sections + slots);
+  old_slots = (const void *)(old_events + events);
+  old_text = (const void *)(old_slots + event_slots);
+} /*}}}*/
+
+/* Do the events and text of a section of the old file lie within it? */
+static bool old_valid(const struct cache_section *s) {
+  uint32_t i;
+  if (s->first + (uint64_t)s->count > old->events)
+    return false;
+  for (i = 0; i < s->count; i++)
+    if (old_events[s->first + i].text + (uint64_t)old_events[s->first + i].len > old->text)
+      return false;
+  return true;
+}
+
+/* Find a section in the old file. {{{
+ * The probes of both tables stop after n slots, a file with all of them
+ * used would not end them otherwise. */
+static const struct cache_section *old_find(uint16_t onid, uint16_t sid, uint8_t tid, uint8_t number) {
+  size_t n = old->slots, i, probes;
+  if (n == 0)
+    return NULL;
+  for (i = section_hash(onid, sid, tid, number) & (n - 1), probes = 0;
+      probes < n && old_sections[i].used; i = (i + 1) & (n - 1), probes++) {
+    const struct cache_section *s = &old_sections[i];
+    if (s->onid == onid && s->sid == sid && s->tid == tid && s->number == number)
+      return s;
+  }
+  return NULL;
+} /*}}}*/
+
+/* The events of a section as they were decoded before, or NULL. {{{
+ * text is where the fragments are, at the offsets in the events. */
+const struct cache_event *cache_lookup(const void *sec, size_t len, int *count, const char **text) {
+  const struct eit *e = sec;
+  if (old == NULL)
+    return NULL;
+  const struct cache_section *s = old_find(HILO(e->original_network_id), HILO(e->service_id), e->table_id, e->section_number);
+  if (s == NULL || s->len != len || s->crc != section_crc(sec, len) || !old_valid(s))
+    return NULL;
+  *count = s->count;
+  *text = old_text;
+  return old_events + s->first;
+} /*}}}*/
+
+/* Index of an event in the old file, or -1. */
+static long old_event(uint16_t onid, uint16_t sid, uint16_t eid) {
+  size_t n = old ? old->event_slots : 0, i, probes;
+  if (n == 0)
+    return -1;
+  for (i = event_hash(onid, sid, eid) & (n - 1), probes = 0;
+      probes < n && old_slots[i].used; i = (i + 1) & (n - 1), probes++) {
+    const struct cache_slot *s = &old_slots[i];
+    if (s->onid == onid && s->sid == sid && s->eid == eid)
+      return s->event < old->events ? s->event : -1;
+  }
+  return -1;
+}
+
+/* The fragment output for an event in an earlier run. {{{
+ * Returns its length, 0 if the event was not output. */
+size_t cache_programme(int onid, int sid, int eid, const char **text) {
+  long i = old_event(onid, sid, eid);
+  if (i < 0)
+    return 0;
+  const struct cache_event *c = &old_events[i];
+  if (c->kind != CACHE_PROGRAMME || c->text + (uint64_t)c->len > old->text)
+    return 0;
+  *text = old_text + c->text;
+  return c->len;
+} /*}}}*/
+
+/* Report the programmes gone from sections received again. {{{
+ * Only those that are not over yet and were not seen anywhere else in
+ * this run count, each once. */
+void cache_removed(time_t now, void (*removed)(const char *text, size_t len)) {
+  size_t i;
+  uint32_t j;
+  if (old == NULL)
+    return;
+  for (i = 0; i < new_count; i++) {
+    const struct cache_section *n = &new_sections[i];
+    const struct cache_section *s = old_find(n->onid, n->sid, n->tid, n->number);
+    if (s == NULL || s->crc == n->crc || !old_valid(s))
+      continue;
+    for (j = 0; j < s->count; j++) {
+      const struct cache_event *c = &old_events[s->first + j];
+      if (c->kind != CACHE_PROGRAMME || c->stop <= now ||
+          old_event(s->onid, s->sid, c->eid) != s->first + j ||
+          event_known(s->onid, s->sid, c->eid))
+        continue;
+      removed(old_text + c->text, c->len);
+      event_update(s->onid, s->sid, c->eid, 0, c->stop); // report it only once
+    }
+  }
+} /*}}}*/
+
+/* Remember the events of a section decoded in this run. {{{ */
+void cache_store(const void *sec, size_t len, const struct cache_event *ev, int count, const char *text, size_t text_len) {
+  const struct eit *e = sec;
+  if (path == NULL)
+    return;
+  pthread_mutex_lock(&lock);
+  if (new_count == new_size || new_event_count + count > new_event_size) {
+    size_t ns = new_count == new_size ? (new_size ? 2 * new_size : 256) : new_size;
+    size_t ne = new_event_size;
+    while (new_event_count + count > ne)
+      ne = ne ? 2 * ne : 1024;
+    struct cache_section *s = realloc(new_sections, ns * sizeof(*s));
+    struct cache_event *v = s ? realloc(new_events, ne * sizeof(*v)) : NULL;
+    if (s == NULL || v == NULL) {
+      fprintf(stderr, "Out of memory for cache\n");
+      exit(1);
+    }
+    new_sections = s;
+    new_size = ns;
+    new_events = v;
+    new_event_size = ne;
+  }
+  struct cache_section *s = &new_sections[new_count++];
+  s->onid = HILO(e->original_network_id);
+  s->sid = HILO(e->service_id);
+  s->tid = e->table_id;
+  s->number = e->section_number;
+  s->used = 1;
+  s->pad = 0;
+  s->crc = section_crc(sec, len);
+  s->len = len;
+  s->first = new_event_count;
+  s->count = count;
+  int i;
+  for (i = 0; i < count; i++) {
+    struct cache_event *c = &new_events[new_event_count++];
+    *c = ev[i];
+    c->text += new_text.len;
+  }
+  strbuf_add(&new_text, text, text_len);
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
+
+/* Have all events of a section ended long ago? */
+static bool expired(const struct cache_event *ev, int count, time_t now) {
+  int i;
+  for (i = 0; i < count; i++)
+    if (ev[i].stop > now - CACHE_EXPIRED)
+      return false;
+  return true;
+}
+
+struct merged {
+  const struct cache_event *events;
+  const char *text;
+};
+
+/* Put a section into the table being written, unless its key is there. */
+static size_t merge_section(struct cache_section *table, struct merged *m, size_t slots,
+    const struct cache_section *s, const struct cache_event *ev, const char *tx) {
+  size_t k = section_hash(s->onid, s->sid, s->tid, s->number) & (slots - 1);
+  while (table[k].used && (table[k].onid != s->onid || table[k].sid != s->sid ||
+        table[k].tid != s->tid || table[k].number != s->number))
+    k = (k + 1) & (slots - 1);
+  if (table[k].used)
+    return 0;
+  table[k] = *s;
+  m[k].events = ev;
+  m[k].text = tx;
+  return s->count;
+}
+
+/* Is a section of the old file to be kept? */
+static bool old_kept(const struct cache_section *s, time_t now) {
+  return s->used && old_valid(s) && !expired(old_events + s->first, s->count, now);
+}
+
+/* Write the new cache file, replacing the old one. {{{ */
+int cache_write(void) {
+  if (path == NULL)
+    return 0;
+  time_t now = time(NULL);
+  size_t total = new_count, i, slots;
+  for (i = 0; old && i < old->slots; i++)
+    if (old_kept(&old_sections[i], now))
+      total++;
+  for (slots = 16; slots * 3 < total * 4; slots *= 2)
+    ;
+  struct merged *m = calloc(slots, sizeof(*m));
+  struct cache_section *table = calloc(slots, sizeof(*table));
+  if (m == NULL || table == NULL) {
+    fprintf(stderr, "Out of memory for cache table\n");
+    free(m);
+    free(table);
+    return -1;
+  }
+
+  /* the sections of this run first, the last one of a key wins, then
+   * those of the old file not replaced */
+  size_t events = 0, text = 0;
+  for (i = new_count; i-- > 0; ) {
+    const struct cache_section *s = &new_sections[i];
+    if (!expired(new_events + s->first, s->count, now))
+      events += merge_section(table, m, slots, s, new_events + s->first, new_text.buf);
+  }
+  for (i = 0; old && i < old->slots; i++)
+    if (old_kept(&old_sections[i], now))
+      events += merge_section(table, m, slots, &old_sections[i], old_events + old_sections[i].first, old_text);
+
+  struct strbuf tmp = STRBUF_INIT;
+  strbuf_addf(&tmp, "%s.tmp", path);
+  FILE *f = fopen(tmp.buf, "w");
+  if (f == NULL) {
+    perror(tmp.buf);
+    strbuf_release(&tmp);
+    free(m);
+    free(table);
+    return -1;
+  }
+  struct cache_header h = {
+    .version = CACHE_VERSION,
+    .fingerprint = fingerprint,
+    .slots = slots,
+    .events = events,
+  };
+  memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+  /* events and their text go out in slot order, text offsets rebased */
+  uint32_t first = 0;
+  for (i = 0; i < slots; i++)
+    if (table[i].used) {
+      table[i].first = first;
+      first += table[i].count;
+      uint32_t j;
+      for (j = 0; j < table[i].count; j++)
+        text += m[i].events[j].len;
+    }
+  h.text = text;
+
+  /* the programmes by event, the first one of a key wins */
+  for (h.event_slots = 16; h.event_slots * 3 < events * 4; h.event_slots *= 2)
+    ;
+  struct cache_slot *index = calloc(h.event_slots, sizeof(*index));
+  if (index == NULL) {
+    fclose(f);
+    unlink(tmp.buf);
+    strbuf_release(&tmp);
+    free(m);
+    free(table);
+    return -1;
+  }
+  for (i = 0; i < slots; i++) {
+    uint32_t j;
+    for (j = 0; j < table[i].count; j++) {
+      const struct cache_event *c = &m[i].events[j];
+      if (c->kind != CACHE_PROGRAMME)
+        continue;
+      size_t k = event_hash(table[i].onid, table[i].sid, c->eid) & (h.event_slots - 1);
+      while (index[k].used && (index[k].onid != table[i].onid ||
+            index[k].sid != table[i].sid || index[k].eid != c->eid))
+        k = (k + 1) & (h.event_slots - 1);
+      if (index[k].used)
+        continue;
+      index[k].onid = table[i].onid;
+      index[k].sid = table[i].sid;
+      index[k].eid = c->eid;
+      index[k].used = 1;
+      index[k].event = table[i].first + j;
+    }
+  }
+
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(table, sizeof(*table), slots, f) == slots;
+  uint64_t at = 0;
+  for (i = 0; ok && i < slots; i++) {
+    uint32_t j;
+    for (j = 0; ok && j < table[i].count; j++) {
+      struct cache_event c = m[i].events[j];
+      c.text = at;
+      at += c.len;
+      ok = fwrite(&c, sizeof(c), 1, f) == 1;
+    }
+  }
+  if (ok)
+    ok = fwrite(index, sizeof(*index), h.event_slots, f) == h.event_slots;
+  for (i = 0; ok && i < slots; i++) {
+    uint32_t j;
+    for (j = 0; ok && j < table[i].count; j++) {
+      const struct cache_event *c = &m[i].events[j];
+      ok = !c->len || fwrite(m[i].text + c->text, c->len, 1, f) == 1;
+    }
+  }
+  if (fclose(f) != 0)
+    ok = false;
+  if (ok && rename(tmp.buf, path) < 0)
+    ok = false;
+  if (!ok) {
+    perror(path);
+    unlink(tmp.buf);
+  }
+  strbuf_release(&tmp);
+  free(index);
+  free(m);
+  free(table);
+  return ok ? 0 : -1;
+} /*}}}*/
@@ -0,0 +1,270 @@
+/* channels.c: the channel list, from the service descriptors of the SDT.
+ *
+ * The SDT actual and other of the multiplexes read name their services;
+ * these are kept by (original_network_id, transport_stream_id,
+ * service_id) in an open-addressing table like the one in events.c,
+ * with the name as broadcast, for the writers to convert.
+ *
+ * A channel file can give names of its own, keyed by service_id: the
+ * dvbv5 format with a [name] and SERVICE_ID = line per service, or the
+ * name:...:service_id lines of czap.  It is only read once, into a
+ * table of the same kind, and wins over the SDT.  Without any SDT, all
+ * of its services are listed, as before there was the SDT.
+ *
+ * Completion of the SDT actual is tracked per device and transport
+ * stream, so the channel list can be written as soon as every device
+ * has had all sections of its multiplex, see channels_sdt(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+#define CHANNELS_MIN_SIZE 64
+
+struct channel {
+  uint16_t onid;
+  uint16_t tsid;
+  uint16_t sid;
+  uint8_t used;
+  uint8_t len;          // of name
+  unsigned order;       // of arrival, for the channel file
+  char name[256];       // DVB string, 0x15 in front if from the channel file
+};
+
+struct channel_table {
+  struct channel *slots;
+  size_t size, count;
+};
+
+/* SDT actual sections received of one transport stream by a device. */
+struct sdt_progress {
+  int source;
+  uint16_t onid;
+  uint16_t tsid;
+  uint8_t ver;
+  uint8_t last_section;
+  bool done;
+  uint8_t seen[256 / 8];
+};
+
+static struct channel_table services;   // from the SDT
+static struct channel_table overrides;  // from the channel file, onid and tsid 0
+static struct sdt_progress *streams;
+static int stream_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t channel_hash(uint16_t onid, uint16_t tsid, uint16_t sid) {
+  uint64_t k = ((uint64_t)onid << 32) | ((uint64_t)tsid << 16) | sid;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static struct channel *channel_find(struct channel *t, size_t n, uint16_t onid, uint16_t tsid, uint16_t sid) {
+  size_t i = channel_hash(onid, tsid, sid) & (n - 1);
+  while (t[i].used && (t[i].onid != onid || t[i].tsid != tsid || t[i].sid != sid))
+    i = (i + 1) & (n - 1);
+  return &t[i];
+}
+
+/* Find the slot of a service, adding it if it is new. {{{ */
+static struct channel *channel_add(struct channel_table *t, uint16_t onid, uint16_t tsid, uint16_t sid) {
+  if (4 * (t->count + 1) > 3 * t->size) {
+    /* double the table and re-insert all slots */
+    size_t n = t->size ? t->size * 2 : CHANNELS_MIN_SIZE, i;
+    struct channel *s = calloc(n, sizeof(struct channel));
+    if (s == NULL) {
+      fprintf(stderr, "Out of memory for channel table\n");
+      exit(1);
+    }
+    for (i = 0; i < t->size; i++)
+      if (t->slots[i].used)
+        *channel_find(s, n, t->slots[i].onid, t->slots[i].tsid, t->slots[i].sid) = t->slots[i];
+    free(t->slots);
+    t->slots = s;
+    t->size = n;
+  }
+  struct channel *c = channel_find(t->slots, t->size, onid, tsid, sid);
+  if (!c->used) {
+    c->onid = onid;
+    c->tsid = tsid;
+    c->sid = sid;
+    c->used = 1;
+    c->order = t->count++;
+  }
+  return c;
+} /*}}}*/
+
+static struct channel *channel_override(uint16_t sid) {
+  if (overrides.size == 0)
+    return NULL;
+  struct channel *c = channel_find(overrides.slots, overrides.size, 0, 0, sid);
+  return c->used ? c : NULL;
+}
+
+/* A name from the channel file, which is UTF-8 unlike DVB strings. {{{ */
+static void add_override(int sid, const char *name, size_t len) {
+  if (sid <= 0 || sid > 0xFFFF || channel_override(sid))
+    return; // the first one in the file wins
+  struct channel *c = channel_add(&overrides, 0, 0, sid);
+  if (len > sizeof(c->name) - 2)
+    len = sizeof(c->name) - 2;
+  c->name[0] = 0x15; // ISO/IEC 10646 UTF-8
+  memcpy(c->name + 1, name, len);
+  c->len = len + 1;
+} /*}}}*/
+
+/* Read the names of a channel file. {{{
+ * Returns the number of services named, -1 if it can't be read. */
+int channels_load(const char *file) {
+  char line[512], name[256] = "";
+  FILE *f = fopen(file, "r");
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    char *s = line, *e;
+    while (isspace((unsigned char)*s))
+      s++;
+    if (*s == '[' && (e = strchr(s, ']'))) { // dvbv5: [name]
+      snprintf(name, sizeof(name), "%.*s", (int)(e - s - 1), s + 1);
+    } else if (strncmp(s, "SERVICE_ID", 10) == 0 && (e = strchr(s, '='))) {
+      if (*name)
+        add_override(atoi(e + 1), name, strlen(name));
+    } else if ((e = strchr(s, ':'))) {
+      /* czap: name:freq:inversion:symbol_rate:fec:quant:vid:aid:chanid:... */
+      char *c = e;
+      int i;
+      for (i = 1; i < 8 && c; i++)
+        c = strchr(c + 1, ':');
+      if (c)
+        add_override(atoi(c + 1), s, e - s);
+    }
+  }
+  fclose(f);
+  return overrides.count;
+} /*}}}*/
+
+/* Note an SDT actual section, has its transport stream become complete? {{{
+ * Only once for every device and stream, a new version_number after
+ * that changes nothing. */
+static bool sdt_progress(int source, const struct sdt *sdt) {
+  int tsid = HILO(sdt->transport_stream_id), onid = HILO(sdt->original_network_id), i, s;
+  struct sdt_progress *p;
+  for (i = 0; i < stream_count; i++)
+    if (streams[i].source == source && streams[i].tsid == tsid && streams[i].onid == onid)
+      break;
+  if (i == stream_count) {
+    p = realloc(streams, (stream_count + 1) * sizeof(*p));
+    if (p == NULL) {
+      fprintf(stderr, "Out of memory for channel table\n");
+      exit(1);
+    }
+    streams = p;
+    memset(&streams[stream_count++], 0, sizeof(*p));
+    streams[i].source = source;
+    streams[i].tsid = tsid;
+    streams[i].onid = onid;
+    streams[i].ver = sdt->version_number;
+  }
+  p = &streams[i];
+  if (p->done)
+    return false;
+  if (p->ver != sdt->version_number) {
+    p->ver = sdt->version_number;
+    memset(p->seen, 0, sizeof(p->seen));
+  }
+  p->last_section = sdt->last_section_number;
+  p->seen[sdt->section_number / 8] |= 1 << (sdt->section_number % 8);
+  for (s = 0; s <= p->last_section; s++)
+    if (!(p->seen[s / 8] & (1 << (s % 8))))
+      return false;
+  return p->done = true;
+} /*}}}*/
+
+/* Take the service names of an SDT section, CRC checked already. {{{
+ * Returns true when it completed the SDT actual of its transport stream
+ * for the device source, the index of the one it was read from. */
+bool channels_sdt(int source, const uint8_t *sec, size_t len) {
+  const struct sdt *sdt = (const struct sdt *)sec;
+  size_t pos = SDT_LEN;
+  bool done = false;
+
+  if (len < SDT_LEN + 4 || (sdt->table_id != 0x42 && sdt->table_id != 0x46))
+    return false;
+  pthread_mutex_lock(&lock);
+  while (pos + SDT_DESCR_LEN <= len - 4) {
+    const struct sdt_descr *sd = (const struct sdt_descr *)(sec + pos);
+    size_t d = pos + SDT_DESCR_LEN, end = d + GetSDTDescriptorsLoopLength(sd);
+    if (end > len - 4)
+      break;
+    for (; d + 2 <= end && d + 2 + sec[d + 1] <= end; d += 2 + sec[d + 1]) {
+      const uint8_t *ds = sec + d;
+      /* service_descriptor: type, provider name, service name */
+      if (ds[0] != 0x48 || ds[1] < 3 || 5 + ds[3] > 2 + ds[1] ||
+          5 + ds[3] + ds[4 + ds[3]] > 2 + ds[1])
+        continue;
+      int n = ds[4 + ds[3]];
+      struct channel *c = channel_add(&services, GetSDTOriginalNetworkId(sdt), GetSDTTransportStreamId(sdt), HILO(sd->service_id));
+      memcpy(c->name, ds + 5 + ds[3], n);
+      c->len = n;
+    }
+    pos = end;
+  }
+  if (sdt->table_id == 0x42)
+    done = sdt_progress(source, sdt);
+  pthread_mutex_unlock(&lock);
+  return done;
+} /*}}}*/
+
+static int compare_channels(const void *a, const void *b) {
+  const struct channel *x = *(const struct channel **)a;
+  const struct channel *y = *(const struct channel **)b;
+  if (x->onid != y->onid)
+    return x->onid - y->onid;
+  if (x->tsid != y->tsid)
+    return x->tsid - y->tsid;
+  return x->sid - y->sid;
+}
+
+static int compare_order(const void *a, const void *b) {
+  const struct channel *x = *(const struct channel **)a;
+  const struct channel *y = *(const struct channel **)b;
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Pass every channel to fn, with the name of the channel file if any. {{{
+ * The SDT ones by network, transport stream and service, each service_id
+ * only once; without them those of the file, in its order. */
+void channels_list(void (*fn)(int sid, const char *name, int len)) {
+  pthread_mutex_lock(&lock);
+  struct channel_table *t = services.count ? &services : &overrides;
+  const struct channel **v = malloc((t->count + 1) * sizeof(*v));
+  uint8_t listed[0x10000 / 8] = { 0 };
+  size_t i, n = 0;
+  if (v == NULL) {
+    fprintf(stderr, "Out of memory for channel table\n");
+    exit(1);
+  }
+  for (i = 0; i < t->size; i++)
+    if (t->slots[i].used)
+      v[n++] = &t->slots[i];
+  qsort(v, n, sizeof(*v), t == &services ? compare_channels : compare_order);
+  for (i = 0; i < n; i++) {
+    int sid = v[i]->sid;
+    const struct channel *c = channel_override(sid);
+    if (listed[sid / 8] & (1 << (sid % 8)))
+      continue;
+    listed[sid / 8] |= 1 << (sid % 8);
+    if (c == NULL)
+      c = v[i];
+    if (c->len)
+      fn(sid, c->name, c->len);
+  }
+  free(v);
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
@@ -0,0 +1,84 @@
+#! /usr/bin/awk -f
+# Turn charsets.tab into the byte to Unicode tables of charsets.c
+function ident(name)
+{
+	gsub(/[^A-Za-z0-9]/, "_", name)
+	return "cs_" name
+}
+function hex(s,    i, n, c)
+{
+	n = 0
+	s = toupper(s)
+	for (i = 1; i <= length(s); i++) {
+		c = index("0123456789ABCDEF", substr(s, i, 1)) - 1
+		n = n * 16 + c
+	}
+	return n
+}
+function value(v)
+{
+	return v == "----" ? "0xFFFF" : "0x" v
+}
+BEGIN \
+{
+	print "#include \"tv_grab_dvb.h\""
+	n = 0
+}
+/^#/ \
+{
+	next
+}
+/^$/ \
+{
+	next
+}
+{
+	if (!($1 in seen)) {
+		seen[$1] = 1
+		names[n++] = $1
+	}
+	if (index($2, ":")) {
+		split($2, pr, ":")
+		row = $1 SUBSEP (hex(pr[1]) - 193) SUBSEP (hex(pr[2]) - 32)
+		diacritic[$1] = 1
+	} else
+		row = $1 SUBSEP hex($2)
+	for (i = 3; i <= NF; i++)
+		rows[row, i - 3] = value($i)
+	present[row] = 1
+}
+END \
+{
+	for (c = 0; c < n; c++) {
+		name = names[c]
+		print ""
+		print "static const uint16_t " ident(name) "[256] = {"
+		for (r = 0; r < 256; r += 16) {
+			line = "\t"
+			for (i = 0; i < 16; i++)
+				line = line (present[name, r] ? rows[name SUBSEP r, i] : "0xFFFF") ","
+			print line
+		}
+		print "};"
+		if (diacritic[name]) {
+			print "static const uint16_t " ident(name) "_diacritic[15][96] = {"
+			for (p = 0; p < 15; p++) {
+				print "\t{"
+				for (r = 0; r < 96; r += 16) {
+					line = "\t\t"
+					for (i = 0; i < 16; i++)
+						line = line (present[name, p, r] ? rows[name SUBSEP p SUBSEP r, i] : "0xFFFF") ","
+					print line
+				}
+				print "\t},"
+			}
+			print "};"
+		}
+	}
+	print ""
+	print "const struct charset charsets[] = {"
+	for (c = 0; c < n; c++)
+		print "\t{\"" names[c] "\", " ident(names[c]) ", " (diacritic[names[c]] ? ident(names[c]) "_diacritic" : "NULL") "},"
+	print "\t{NULL, NULL, NULL},"
+	print "};"
+}
@@ -0,0 +1,152 @@
+/* compress.c: gzip or zstd of the output, for --compress.
+ *
+ * output.c passes everything it writes through compress_data(), at the
+ * end of whole programmes, and writes what comes out instead.  Once
+ * COMPRESS_FLUSH bytes went in since the last time, the compressor is
+ * flushed at the end of the call, so a reader decompressing as the
+ * file grows gets every programme up to there: Z_SYNC_FLUSH for gzip,
+ * the end of a block for zstd.  Each costs a little of the ratio.
+ *
+ * Either library is optional, built in with HAVE_ZLIB or HAVE_ZSTD. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "tv_grab_dvb.h"
+
+#define COMPRESS_FLUSH (1 << 20)  // bytes of input between flushes
+#define COMPRESS_CHUNK (64 << 10) // of output, grown by
+
+enum { COMPRESS_NONE, COMPRESS_GZIP, COMPRESS_ZSTD };
+
+static int kind = COMPRESS_NONE;
+static size_t unflushed;
+#ifdef HAVE_ZLIB
+static z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+static ZSTD_CCtx *zc;
+#endif
+
+/* Set up the compressor named by gzip[:level] or zstd[:level]. {{{
+ * Without a level, the default of the library is used; gzip takes -1
+ * to 9, zstd its negative fast levels up to ZSTD_maxCLevel().  Returns
+ * false for one unknown or not built in, or a level it doesn't have. */
+bool compress_init(const char *spec) {
+  const char *colon = strchr(spec, ':');
+  size_t n = colon ? (size_t)(colon - spec) : strlen(spec);
+  char *end;
+  long level = 0; // only used if given
+  if (colon) {
+    level = strtol(colon + 1, &end, 10);
+    if (*end || end == colon + 1)
+      return false;
+  }
+#ifdef HAVE_ZLIB
+  if (n == 4 && strncmp(spec, "gzip", 4) == 0) {
+    if (colon && (level < -1 || level > 9))
+      return false;
+    /* 16 more window bits for a gzip header and trailer */
+    if (deflateInit2(&z, colon ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+    kind = COMPRESS_GZIP;
+    return true;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  if (n == 4 && strncmp(spec, "zstd", 4) == 0) {
+    if (colon && (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel()))
+      return false;
+    if ((zc = ZSTD_createCCtx()) == NULL)
+      return false;
+    if (colon)
+      ZSTD_CCtx_setParameter(zc, ZSTD_c_compressionLevel, level);
+    kind = COMPRESS_ZSTD;
+    return true;
+  }
+#endif
+  (void)n;
+  (void)level;
+  return false;
+}
+
+bool compress_enabled(void) {
+  return kind != COMPRESS_NONE;
+} /*}}}*/
+
+#ifdef HAVE_ZLIB
+static void gzip_data(struct strbuf *out, const void *data, size_t len, int flush) {
+  z.next_in = (Bytef *)data;
+  z.avail_in = len;
+  for (;;) {
+    strbuf_grow(out, COMPRESS_CHUNK);
+    z.next_out = (Bytef *)out->buf + out->len;
+    z.avail_out = out->size - out->len - 1;
+    size_t avail = z.avail_out;
+    int r = deflate(&z, flush);
+    if (r == Z_STREAM_ERROR) {
+      fprintf(stderr, "Output compression failed\n");
+      exit(1);
+    }
+    out->len += avail - z.avail_out;
+    /* all output space used, there may be more to come */
+    if (flush == Z_FINISH ? r == Z_STREAM_END : z.avail_out != 0)
+      break;
+  }
+  if (flush == Z_FINISH)
+    deflateEnd(&z);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void zstd_data(struct strbuf *out, const void *data, size_t len, ZSTD_EndDirective mode) {
+  ZSTD_inBuffer in = { data, len, 0 };
+  size_t left;
+  do {
+    strbuf_grow(out, COMPRESS_CHUNK);
+    ZSTD_outBuffer o = { out->buf + out->len, out->size - out->len - 1, 0 };
+    left = ZSTD_compressStream2(zc, &o, &in, mode);
+    if (ZSTD_isError(left)) {
+      fprintf(stderr, "Output compression failed: %s\n", ZSTD_getErrorName(left));
+      exit(1);
+    }
+    out->len += o.pos;
+  } while (mode == ZSTD_e_continue ? in.pos < in.size : left > 0);
+  if (mode == ZSTD_e_end)
+    ZSTD_freeCCtx(zc);
+}
+#endif
+
+/* Append len bytes compressed to out, the last ones if end. {{{ */
+void compress_data(struct strbuf *out, const void *data, size_t len, bool end) {
+  bool flush = (unflushed += len) >= COMPRESS_FLUSH;
+  if (flush)
+    unflushed = 0;
+  switch (kind) {
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+      gzip_data(out, data, len, end ? Z_FINISH : flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+      zstd_data(out, data, len, end ? ZSTD_e_end : flush ? ZSTD_e_flush : ZSTD_e_continue);
+      break;
+#endif
+    default:
+      strbuf_add(out, data, len);
+      break;
+  }
+  if (end)
+    kind = COMPRESS_NONE;
+  if (out->buf)
+    out->buf[out->len] = '\0';
+} /*}}}*/
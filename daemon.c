@@ -0,0 +1,393 @@
+/* daemon.c: serving the listing while reading goes on, for --daemon.
+ *
+ * Every programme decoded is kept rendered, by (original_network_id,
+ * service_id, event_id), the latest rendering replacing the one before,
+ * in an open-addressing table like the one in events.c.  The texts are
+ * allocated from an arena.  Programmes that are over are dropped once a
+ * minute, together with their events in events.c, and the texts left
+ * copied to a fresh arena when that saves half of it, so the state stays
+ * as big as the schedules broadcast.
+ *
+ * Clients connect to a Unix stream socket and send one line:
+ *
+ *   snapshot  the whole listing as one document, then the socket closes
+ *   watch     the head of a document, then every programme of a new
+ *             present/following section (table 0x4E or 0x4F) as it is
+ *             decoded, for as long as the client stays
+ *   stats     a line of memory counters for every arena, see arena.c
+ *   metrics   all counters and stage times in the Prometheus text format,
+ *             "metrics json" the same as JSON, see stats.c
+ *
+ * With "-" for the socket, the watch stream goes to standard output.
+ * A thread of its own accepts and writes to the clients, so the readers
+ * and decoders only append to buffers under the lock; a client falling
+ * more than CLIENT_BACKLOG behind is dropped. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tv_grab_dvb.h"
+
+#define STORE_MIN_SIZE 1024
+#define MAX_CLIENTS    64
+#define CLIENT_BACKLOG (4 << 20)  // bytes not written yet
+#define EXPIRE_EVERY   60         // seconds
+
+struct stored {
+  uint16_t onid;
+  uint16_t sid;
+  uint16_t eid;
+  uint8_t used;
+  int64_t start, stop;
+  char *text;       // rendered by the writer, in the arena
+  size_t len;
+};
+
+enum client_state { CLIENT_COMMAND, CLIENT_WATCH, CLIENT_DONE };
+
+struct client {
+  int fd;
+  enum client_state state;
+  char command[64];
+  size_t command_len;
+  struct strbuf out;
+  size_t sent;      // of out
+};
+
+static struct stored *slots;
+static size_t size, count;
+static size_t text_bytes;     // of the texts still in use
+static struct arena texts = ARENA_INIT("programme texts");
+static struct arena spare = ARENA_INIT("programme texts, compacting");
+static struct arena table = ARENA_INIT("programme table");
+static struct client clients[MAX_CLIENTS];
+static int client_count;
+static const struct writer *writer;
+static void (*write_channels)(void);
+static const char *socket_path;
+static int listen_fd = -1;
+static int wake[2];           // a byte in it when there is output
+static bool woken;
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t stored_hash(uint16_t onid, uint16_t sid, uint16_t eid) {
+  uint64_t k = ((uint64_t)onid << 32) | ((uint64_t)sid << 16) | eid;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static struct stored *stored_find(struct stored *t, size_t n, uint16_t onid, uint16_t sid, uint16_t eid) {
+  size_t i = stored_hash(onid, sid, eid) & (n - 1);
+  while (t[i].used && (t[i].onid != onid || t[i].sid != sid || t[i].eid != eid))
+    i = (i + 1) & (n - 1);
+  return &t[i];
+}
+
+/* Re-insert the programmes stopping after before into n slots. {{{
+ * Compacting, their texts are copied to a fresh arena too. */
+static void stored_rehash(size_t n, time_t before, bool compact) {
+  struct stored *t = calloc(n, sizeof(struct stored));
+  size_t i;
+  if (t == NULL) {
+    fprintf(stderr, "Out of memory for programme store\n");
+    exit(1);
+  }
+  count = 0;
+  for (i = 0; i < size; i++) {
+    if (!slots[i].used)
+      continue;
+    if (slots[i].stop <= before) {
+      text_bytes -= slots[i].len;
+      continue;
+    }
+    struct stored *s = stored_find(t, n, slots[i].onid, slots[i].sid, slots[i].eid);
+    *s = slots[i];
+    if (compact)
+      s->text = arena_copy(&spare, s->text, s->len);
+    count++;
+  }
+  if (compact) {
+    arena_swap(&texts, &spare);
+    arena_reset(&spare);
+  }
+  free(slots);
+  slots = t;
+  size = n;
+  arena_count(&table, count * sizeof(struct stored), size * sizeof(struct stored));
+} /*}}}*/
+
+/* Queue output for a client, dropping it if it is too far behind. {{{ */
+static void client_queue(struct client *c, const char *text, size_t len) {
+  if (c->out.len - c->sent + len > CLIENT_BACKLOG) {
+    fprintf(stderr, "Dropping a client too slow to keep up\n");
+    c->state = CLIENT_DONE;
+    c->out.len = c->sent = 0;
+    return;
+  }
+  strbuf_add(&c->out, text, len);
+  if (!woken && write(wake[1], "", 1) == 1)
+    woken = true;
+} /*}}}*/
+
+/* Keep a rendered programme, pushing it to the watchers for p/f. {{{ */
+void daemon_programme(const struct programme *p, bool now_next, const char *text, size_t len) {
+  int i;
+  pthread_mutex_lock(&lock);
+  if (4 * (count + 1) > 3 * size)
+    stored_rehash(size ? size * 2 : STORE_MIN_SIZE, 0, false);
+  struct stored *s = stored_find(slots, size, p->onid, p->sid, p->eid);
+  if (!s->used) {
+    s->onid = p->onid;
+    s->sid = p->sid;
+    s->eid = p->eid;
+    s->used = 1;
+    count++;
+    arena_count(&table, count * sizeof(struct stored), size * sizeof(struct stored));
+  } else
+    text_bytes -= s->len; // left in the arena until it is compacted
+  s->text = arena_copy(&texts, text, len);
+  s->len = len;
+  text_bytes += len;
+  s->start = p->start;
+  s->stop = p->stop;
+  if (now_next)
+    for (i = 0; i < client_count; i++)
+      if (clients[i].state == CLIENT_WATCH)
+        client_queue(&clients[i], text, len);
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
+
+static int compare_stored(const void *a, const void *b) {
+  const struct stored *x = *(const struct stored **)a;
+  const struct stored *y = *(const struct stored **)b;
+  if (x->sid != y->sid)
+    return x->sid - y->sid;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return x->onid - y->onid;
+}
+
+/* Render the whole listing for a client, with the lock held. {{{
+ * The writers append to this thread's output, which is swapped in. */
+static void snapshot(struct client *c) {
+  const struct stored **v = malloc((count + 1) * sizeof(*v));
+  time_t now = time(NULL);
+  size_t i, n = 0;
+  if (v == NULL) {
+    fprintf(stderr, "Out of memory for programme store\n");
+    exit(1);
+  }
+  for (i = 0; i < size; i++)
+    if (slots[i].used && slots[i].stop > now)
+      v[n++] = &slots[i];
+  qsort(v, n, sizeof(*v), compare_stored);
+
+  struct strbuf saved = output;
+  output = c->out;
+  writer->head();
+  write_channels();
+  for (i = 0; i < n; i++)
+    strbuf_add(&output, v[i]->text, v[i]->len);
+  writer->tail();
+  c->out = output;
+  output = saved;
+  free(v);
+} /*}}}*/
+
+static void stats_line(const char *name, size_t used, size_t reserved, void *arg) {
+  strbuf_addf(arg, "%s: %zu bytes used, %zu reserved\n", name, used, reserved);
+}
+
+/* Act on the line a client sent. {{{ */
+static void client_command(struct client *c) {
+  char *nl = memchr(c->command, '\n', c->command_len);
+  if (nl == NULL) {
+    if (c->command_len == sizeof(c->command))
+      c->state = CLIENT_DONE; // not a command of ours
+    return;
+  }
+  *nl = '\0';
+  if (nl > c->command && nl[-1] == '\r')
+    nl[-1] = '\0';
+  if (strcmp(c->command, "snapshot") == 0) {
+    snapshot(c);
+    c->state = CLIENT_DONE;
+  } else if (strcmp(c->command, "stats") == 0) {
+    strbuf_addf(&c->out, "programmes: %zu, %zu bytes of text\n", count, text_bytes);
+    memory_usage(stats_line, &c->out);
+    c->state = CLIENT_DONE;
+  } else if (strcmp(c->command, "metrics") == 0 || strcmp(c->command, "metrics json") == 0) {
+    metrics_write(&c->out, c->command[7] == ' ');
+    c->state = CLIENT_DONE;
+  } else if (strcmp(c->command, "watch") == 0) {
+    struct strbuf saved = output;
+    output = c->out;
+    writer->head();
+    c->out = output;
+    output = saved;
+    c->state = CLIENT_WATCH;
+  } else
+    c->state = CLIENT_DONE;
+} /*}}}*/
+
+static void client_add(int fd, enum client_state state) {
+  struct client *c = &clients[client_count++];
+  memset(c, 0, sizeof(*c));
+  c->fd = fd;
+  c->state = state;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/* Write what a client has queued, true if it is to be closed. {{{ */
+static bool client_write(struct client *c) {
+  while (c->sent < c->out.len) {
+    ssize_t r = c->fd == STDOUT_FILENO ? write(c->fd, c->out.buf + c->sent, c->out.len - c->sent) :
+        send(c->fd, c->out.buf + c->sent, c->out.len - c->sent, MSG_NOSIGNAL);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && errno == EAGAIN)
+      return false;
+    if (r <= 0)
+      return true;
+    c->sent += r;
+  }
+  c->out.len = c->sent = 0;
+  return c->state == CLIENT_DONE;
+} /*}}}*/
+
+/* Accept clients, read their commands and write to them. {{{ */
+static void *daemon_thread(void *arg) {
+  time_t expired = time(NULL);
+  for (;;) {
+    struct pollfd pfd[MAX_CLIENTS + 2];
+    int i, n = 0;
+
+    pthread_mutex_lock(&lock);
+    pfd[n].fd = wake[0];
+    pfd[n++].events = POLLIN;
+    pfd[n].fd = listen_fd;
+    pfd[n++].events = client_count < MAX_CLIENTS ? POLLIN : 0;
+    for (i = 0; i < client_count; i++) {
+      pfd[n].fd = clients[i].fd;
+      pfd[n++].events = (clients[i].state == CLIENT_COMMAND ? POLLIN : 0) |
+          (clients[i].sent < clients[i].out.len ? POLLOUT : 0);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (poll(pfd, n, 1000) < 0 && errno != EINTR) {
+      perror("poll");
+      exit(1);
+    }
+
+    pthread_mutex_lock(&lock);
+    if (pfd[0].revents) {
+      char b[64];
+      while (read(wake[0], b, sizeof(b)) > 0)
+        ;
+      woken = false;
+    }
+    for (i = 0; i < client_count; i++) {
+      struct client *c = &clients[i];
+      short revents = pfd[i + 2].revents;
+      if (c->state == CLIENT_COMMAND && (revents & POLLIN)) {
+        ssize_t r = read(c->fd, c->command + c->command_len, sizeof(c->command) - c->command_len);
+        if (r <= 0)
+          c->state = CLIENT_DONE;
+        else {
+          c->command_len += r;
+          client_command(c);
+        }
+      }
+      if (client_write(c) || (revents & (POLLERR | POLLHUP) && !(revents & POLLIN))) {
+        if (c->fd != STDOUT_FILENO)
+          close(c->fd);
+        strbuf_release(&c->out);
+        clients[i--] = clients[--client_count];
+      }
+    }
+    if (pfd[1].revents & POLLIN) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0)
+        client_add(fd, CLIENT_COMMAND);
+    }
+    time_t now = time(NULL);
+    if (now - expired >= EXPIRE_EVERY) {
+      size_t n = size;
+      expired = now;
+      stored_rehash(n, now, false);
+      while (n > STORE_MIN_SIZE && 4 * count < n)
+        n /= 2;
+      bool compact = 2 * text_bytes < texts.used;
+      if (n != size || compact)
+        stored_rehash(n, now, compact);
+      events_expire(now);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+  return NULL;
+} /*}}}*/
+
+static void daemon_exit(int sig) {
+  if (socket_path)
+    unlink(socket_path);
+  _exit(0);
+}
+
+/* Listen on a socket, or stream to stdout for "-". {{{ */
+void daemon_start(const char *path, const struct writer *w, void (*channels)(void)) {
+  writer = w;
+  write_channels = channels;
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(wake) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  fcntl(wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake[1], F_SETFL, O_NONBLOCK);
+
+  if (strcmp(path, "-") == 0) {
+    client_add(STDOUT_FILENO, CLIENT_COMMAND);
+    memcpy(clients[0].command, "watch\n", 6);
+    clients[0].command_len = 6;
+    client_command(&clients[0]);
+  } else {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "%s: Socket path too long\n", path);
+      exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 8) < 0) {
+      perror(path);
+      exit(1);
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+    socket_path = path;
+    signal(SIGINT, daemon_exit);
+    signal(SIGTERM, daemon_exit);
+  }
+  if (pthread_create(&thread, NULL, daemon_thread, NULL) != 0) {
+    fprintf(stderr, "Unable to start daemon thread\n");
+    exit(1);
+  }
+} /*}}}*/
+
+/* Serve on after the input ended, until killed. */
+void daemon_wait(void) {
+  pthread_join(thread, NULL);
+}
@@ -3,11 +3,20 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
 #include <iconv.h>
 
-#define MAX 1024
-static char buf[MAX * 6]; /* UTF-8 needs up to 6 bytes */
-static char result[MAX * 6]; /* xml-ification needs up to 6 bytes */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SCAN_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_SCAN_NEON
+#endif
+
+#include "tv_grab_dvb.h"
+
+#define MAX 1024 /* bytes passed to iconv() at a time */
 
 /* The spec says ISO-6937, but many stations get it wrong and use ISO-8859-1. */
 char *iso6937_encoding = "ISO6937";
@@ -32,7 +41,6 @@ static int encoding_variable(char *t, const char **s, const char *d) {
 }
 
 static int encoding_reserved(char *t, const char **s, const char *d) {
-	fprintf(stderr, "Reserved encoding: %02x\n", *s[0]);
 	return 1;
 }
 
@@ -75,95 +83,497 @@ static const struct encoding {
 	[0x20 ... 0xFF] = {encoding_default, NULL},
 };
 
-static char cs_old[16];
-static iconv_t cd;
+/* Open conversion descriptors, one per character set name. Stations mix
+ * encodings between titles and descriptions, and iconv_open() has to load
+ * the gconv module each time, so keep them around.  Character sets we can
+ * decode ourselves only use iconv() for strings the native decoder
+ * rejects, so any error is reported just like before.  A descriptor
+ * must not be shared between threads, so each thread has its own set.
+ * One iconv_open() failed for stays cached too, with cd (iconv_t)-1. */
+enum native { NATIVE_NONE, NATIVE_TABLE, NATIVE_UTF8, NATIVE_UTF16BE };
 
-/* Quote the xml entities in the string passed in.
- */
-char *xmlify(const char *s, int *len) {
-	char cs_new[16];
+#define CD_CACHE 16
+static struct cd_cache {
+	char name[16];
+	iconv_t cd;
+	enum native native;
+	const struct charset *cs;
+	int ascii; /* the table maps 0x00-0x7F to itself */
+} __thread cd_cache[CD_CACHE];
+static __thread int cd_next; /* slot to replace next, once all are used */
 
-	int i = (int)(unsigned char)s[0];
-  /* get the string encoding, then remove the first byte(s) */
-	if (encoding[i].handler(cs_new, &s, encoding[i].data))
-		return "";
-	if (strncmp(cs_old, cs_new, 16)) {
-		if (cd) {
-			iconv_close(cd);
-			cd = NULL;
+/* Compare character set names ignoring case and punctuation, so that
+ * -e iso-8859-1 finds the ISO-8859-1 table. */
+static int same_charset(const char *a, const char *b) {
+	for (;;) {
+		while (*a && !isalnum((unsigned char)*a))
+			a++;
+		while (*b && !isalnum((unsigned char)*b))
+			b++;
+		if (toupper((unsigned char)*a) != toupper((unsigned char)*b))
+			return 0;
+		if (!*a)
+			return 1;
+		a++;
+		b++;
+	} // for
+} // same_charset
+
+static void find_native(struct cd_cache *c) {
+	const struct charset *cs;
+	c->native = NATIVE_NONE;
+	if (same_charset(c->name, "UTF-8") || same_charset(c->name, "ISO-10646/UTF8"))
+		c->native = NATIVE_UTF8;
+	else if (same_charset(c->name, "UTF-16BE"))
+		c->native = NATIVE_UTF16BE;
+	else for (cs = charsets; cs->name; cs++)
+		if (same_charset(c->name, cs->name)) {
+			int i;
+			c->native = NATIVE_TABLE;
+			c->cs = cs;
+			for (i = 0; i < 0x80 && cs->map[i] == i; i++)
+				;
+			c->ascii = i == 0x80;
+			break;
 		} // if
-		cd = iconv_open("UTF-8", cs_new);
-		if (cd == (iconv_t)-1) {
-			fprintf(stderr, "iconv_open() failed: %s\n", strerror(errno));
-			exit(1);
+} // find_native
+
+/* The descriptor for a character set, told about on stderr if tell and
+ * iconv_open() fails for it. */
+static struct cd_cache *get_cd(const char *name, int tell) {
+	int i;
+	for (i = 0; i < CD_CACHE && cd_cache[i].name[0]; i++)
+		if (!strncmp(cd_cache[i].name, name, 16)) {
+			/* reset the shift state left over from the last string */
+			if (cd_cache[i].cd != (iconv_t)-1)
+				iconv(cd_cache[i].cd, NULL, NULL, NULL, NULL);
+			return &cd_cache[i];
 		} // if
-		strncpy(cs_old, cs_new, 16);
-	} // if
 
-  char *inbuf = (char *)s;
-  size_t inbytesleft = (size_t)len;
-	char *outbuf = (char *)buf;
-	size_t outbytesleft = sizeof(buf);
-  size_t ret = iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
-	if (ret == (size_t)-1) {
-		fprintf(stderr, "iconv() failed: %s\n", strerror(errno));
-    /*exit(1); // FIXME: handle errors*/
+	iconv_t cd = iconv_open("UTF-8", name);
+	if (cd == (iconv_t)-1 && tell)
+		fprintf(stderr, "iconv_open() failed for %.16s: %s\n", name, strerror(errno));
+	if (i == CD_CACHE) {
+		i = cd_next;
+		cd_next = (cd_next + 1) % CD_CACHE;
+		if (cd_cache[i].cd != (iconv_t)-1)
+			iconv_close(cd_cache[i].cd);
 	} // if
+	strncpy(cd_cache[i].name, name, 16);
+	cd_cache[i].cd = cd;
+	find_native(&cd_cache[i]);
+	return &cd_cache[i];
+} // get_cd
 
-	// Luckily '&<> are single byte character sequences in UTF-8 and no
-	// other character will have a UTF-8 sequence containing these
-	// patterns. Because the MSB is set in all multi-byte sequences, we can
-	// simply scan for '&<> and don't have to parse UTF-8 sequences.
+/* Open the default encoding before any data arrives, giving up if there
+ * is no such character set. */
+void xmlify_init(void) {
+	if (get_cd(iso6937_encoding, 1)->cd == (iconv_t)-1)
+		exit(1);
+} // xmlify_init
 
-	char *b = buf, *r = result;
-	for ( ; b < outbuf; b++)
-		switch (*b) {
+/* A control character XML has no place for, that put_xml() let through,
+ * to be told about by xmlify(). */
+static __thread int forbidden = -1;
+
+/* Append one byte of UTF-8, quoting the xml entities. */
+static inline char *put_xml(char *r, char c) {
+	switch (c) {
 #if 0 // only needed for attributes
-			case '"':
-				*r++ = '&';
-				*r++ = 'q';
-				*r++ = 'u';
-				*r++ = 'o';
-				*r++ = 't';
-				*r++ = ';';
-				break;
+		case '"':
+			*r++ = '&';
+			*r++ = 'q';
+			*r++ = 'u';
+			*r++ = 'o';
+			*r++ = 't';
+			*r++ = ';';
+			break;
 #endif
-			case '&':
-				*r++ = '&';
-				*r++ = 'a';
-				*r++ = 'm';
-				*r++ = 'p';
-				*r++ = ';';
-				break;
-			case '<':
-				*r++ = '&';
-				*r++ = 'l';
-				*r++ = 't';
-				*r++ = ';';
-				break;
-			case '>':
-				*r++ = '&';
-				*r++ = 'g';
-				*r++ = 't';
-				*r++ = ';';
-				break;
-			case 0x0000 ... 0x0008:
-			case 0x000B ... 0x001F:
-			case 0x007F:
-				fprintf(stderr, "Forbidden char %02x\n", *b);
-			default:
-				*r++ = *b;
+		case '&':
+			*r++ = '&';
+			*r++ = 'a';
+			*r++ = 'm';
+			*r++ = 'p';
+			*r++ = ';';
+			break;
+		case '<':
+			*r++ = '&';
+			*r++ = 'l';
+			*r++ = 't';
+			*r++ = ';';
+			break;
+		case '>':
+			*r++ = '&';
+			*r++ = 'g';
+			*r++ = 't';
+			*r++ = ';';
+			break;
+		case 0x0000 ... 0x0008:
+		case 0x000B ... 0x001F:
+		case 0x007F:
+			forbidden = c;
+		default:
+			*r++ = c;
+			break;
+	} // switch
+	return r;
+} // put_xml
+
+/* Find the first byte put_xml() has to look at: &<> and the control
+ * characters, with high also any byte >= 0x80.  Everything before it can
+ * be copied as it is.  Needed by every string, so there are SSE2/AVX2 and
+ * NEON versions checking 16 or 32 bytes at a time, picked at startup;
+ * EPGRAB_XML_GENERIC in the environment keeps the plain loop. */
+static inline int special(unsigned char c, int high) {
+	return c < 0x20 || c == 0x7F || c == '&' || c == '<' || c == '>' || (high && c >= 0x80);
+} // special
+
+static size_t scan_scalar(const unsigned char *s, size_t n, int high) {
+	size_t i;
+	for (i = 0; i < n && !special(s[i], high); i++)
+		;
+	return i;
+} // scan_scalar
+
+#ifdef HAVE_SCAN_X86
+static size_t scan_sse2(const unsigned char *s, size_t n, int high) {
+	const __m128i ctrl = _mm_set1_epi8(0x1F), del = _mm_set1_epi8(0x7F);
+	const __m128i amp = _mm_set1_epi8('&'), lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+	size_t i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		/* unsigned x <= 0x1F */
+		__m128i m = _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x);
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, del));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, amp));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, lt));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(x, gt));
+		unsigned bits = _mm_movemask_epi8(m);
+		if (high)
+			bits |= _mm_movemask_epi8(x);
+		if (bits)
+			return i + __builtin_ctz(bits);
+	} // for
+	return i + scan_scalar(s + i, n - i, high);
+} // scan_sse2
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const unsigned char *s, size_t n, int high) {
+	const __m256i ctrl = _mm256_set1_epi8(0x1F), del = _mm256_set1_epi8(0x7F);
+	const __m256i amp = _mm256_set1_epi8('&'), lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+	size_t i;
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(x, ctrl), x);
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, del));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, amp));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, lt));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, gt));
+		unsigned bits = _mm256_movemask_epi8(m);
+		if (high)
+			bits |= _mm256_movemask_epi8(x);
+		if (bits)
+			return i + __builtin_ctz(bits);
+	} // for
+	return i + scan_sse2(s + i, n - i, high);
+} // scan_avx2
+#endif
+
+#ifdef HAVE_SCAN_NEON
+static size_t scan_neon(const unsigned char *s, size_t n, int high) {
+	const uint8x16_t ctrl = vdupq_n_u8(0x20), del = vdupq_n_u8(0x7F);
+	const uint8x16_t amp = vdupq_n_u8('&'), lt = vdupq_n_u8('<'), gt = vdupq_n_u8('>');
+	const uint8x16_t hi = vdupq_n_u8(0x80);
+	size_t i;
+	for (i = 0; i + 16 <= n; i += 16) {
+		uint8x16_t x = vld1q_u8(s + i);
+		uint8x16_t m = vcltq_u8(x, ctrl);
+		m = vorrq_u8(m, vceqq_u8(x, del));
+		m = vorrq_u8(m, vceqq_u8(x, amp));
+		m = vorrq_u8(m, vceqq_u8(x, lt));
+		m = vorrq_u8(m, vceqq_u8(x, gt));
+		if (high)
+			m = vorrq_u8(m, vcgeq_u8(x, hi));
+		/* narrow to 4 bits per byte to get a scalar mask */
+		uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (bits)
+			return i + (__builtin_ctzll(bits) >> 2);
+	} // for
+	return i + scan_scalar(s + i, n - i, high);
+} // scan_neon
+#endif
+
+static size_t (*scan)(const unsigned char *s, size_t n, int high) = scan_scalar;
+
+__attribute__((constructor))
+static void scan_init(void) {
+	if (getenv("EPGRAB_XML_GENERIC"))
+		return;
+#ifdef HAVE_SCAN_X86
+	__builtin_cpu_init();
+	scan = __builtin_cpu_supports("avx2") ? scan_avx2 : scan_sse2;
+#elif defined(HAVE_SCAN_NEON)
+	scan = scan_neon;
+#endif
+} // scan_init
+
+/* Copy n bytes of UTF-8, quoting the xml entities. */
+static char *put_xml_run(char *r, const char *s, size_t n) {
+	while (n) {
+		size_t k = scan((const unsigned char *)s, n, 0);
+		memcpy(r, s, k);
+		r += k;
+		s += k;
+		n -= k;
+		if (n) {
+			r = put_xml(r, *s++);
+			n--;
+		} // if
+	} // while
+	return r;
+} // put_xml_run
+
+/* Append a character as UTF-8, quoting the xml entities. */
+static inline char *put_utf8(char *r, uint32_t c) {
+	if (c < 0x80)
+		return put_xml(r, c);
+	if (c < 0x800)
+		*r++ = 0xC0 | (c >> 6);
+	else {
+		if (c < 0x10000)
+			*r++ = 0xE0 | (c >> 12);
+		else {
+			*r++ = 0xF0 | (c >> 18);
+			*r++ = 0x80 | ((c >> 12) & 0x3F);
+		} // if
+		*r++ = 0x80 | ((c >> 6) & 0x3F);
+	} // if
+	*r++ = 0x80 | (c & 0x3F);
+	return r;
+} // put_utf8
+
+/* Single byte character sets from charsets.tab, including the ISO 6937
+ * non-spacing diacritical marks, which prefix the letter they go on. */
+static char *decode_table(const struct cd_cache *t, const unsigned char *s, size_t len, char *r) {
+	const struct charset *cs = t->cs;
+	const unsigned char *end = s + len;
+	while (s < end) {
+		if (t->ascii) {
+			size_t k = scan(s, end - s, 1);
+			memcpy(r, s, k);
+			r += k;
+			s += k;
+			if (s == end)
 				break;
-		} // switch
+		} // if
+		uint16_t c = cs->map[*s];
+		if (cs->diacritic && *s >= 0xC1 && *s <= 0xCF) {
+			if (s + 1 == end || s[1] < 0x20 || s[1] > 0x7F)
+				return NULL;
+			c = cs->diacritic[*s - 0xC1][s[1] - 0x20];
+			s++;
+		} // if
+		if (c == 0xFFFF)
+			return NULL;
+		r = put_utf8(r, c);
+		s++;
+	} // while
+	return r;
+} // decode_table
+
+/* Only pass on well formed UTF-8, anything else is left to iconv(). */
+static char *decode_utf8(const unsigned char *s, size_t len, char *r) {
+	const unsigned char *end = s + len;
+	while (s < end) {
+		size_t k = scan(s, end - s, 1);
+		memcpy(r, s, k);
+		r += k;
+		s += k;
+		if (s == end)
+			break;
+		unsigned char c = *s;
+		if (c < 0x80) {
+			r = put_xml(r, c);
+			s++;
+			continue;
+		} // if
+		int i, n = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 ? 1 : -1;
+		if (n < 0 || c > 0xF4 || end - s <= n)
+			return NULL;
+		uint32_t u = c & (0x3F >> n);
+		for (i = 1; i <= n; i++) {
+			if ((s[i] & 0xC0) != 0x80)
+				return NULL;
+			u = (u << 6) | (s[i] & 0x3F);
+		} // for
+		if ((n == 2 && u < 0x800) || (n == 3 && (u < 0x10000 || u > 0x10FFFF)) ||
+				(u >= 0xD800 && u <= 0xDFFF))
+			return NULL;
+		memcpy(r, s, n + 1);
+		r += n + 1;
+		s += n + 1;
+	} // while
+	return r;
+} // decode_utf8
+
+static char *decode_utf16be(const unsigned char *s, size_t len, char *r) {
+	const unsigned char *end = s + len;
+	if (len & 1)
+		return NULL;
+	for ( ; s < end; s += 2) {
+		uint32_t u = (s[0] << 8) | s[1];
+		if (u >= 0xD800 && u <= 0xDBFF) {
+			if (end - s < 4)
+				return NULL;
+			uint32_t l = (s[2] << 8) | s[3];
+			if (l < 0xDC00 || l > 0xDFFF)
+				return NULL;
+			u = 0x10000 + ((u - 0xD800) << 10) + (l - 0xDC00);
+			s += 2;
+		} else if (u >= 0xDC00 && u <= 0xDFFF)
+			return NULL;
+		r = put_utf8(r, u);
+	} // for
+	return r;
+} // decode_utf16be
+
+/* Convert to UTF-8 and quote the xml entities in one pass. Returns the end
+ * of the output, which needs room for 5 bytes per input byte, or NULL, if
+ * the string needs iconv(). */
+static char *decode_native(const struct cd_cache *c, const char *s, size_t len, char *r) {
+	switch (c->native) {
+		case NATIVE_TABLE:
+			return decode_table(c, (const unsigned char *)s, len, r);
+		case NATIVE_UTF8:
+			return decode_utf8((const unsigned char *)s, len, r);
+		case NATIVE_UTF16BE:
+			return decode_utf16be((const unsigned char *)s, len, r);
+		default:
+			return NULL;
+	} // switch
+} // decode_native
+
+static void decode_iconv(struct strbuf *out, iconv_t cd, const char *s, size_t len, int tell) {
+	char buf[MAX * 6]; /* UTF-8 needs up to 6 bytes */
+	char *inbuf = (char *)s;
+	size_t inbytesleft = len;
+	size_t ret;
+	do {
+		char *outbuf = buf;
+		size_t outbytesleft = sizeof(buf);
+		ret = iconv(cd, &inbuf, &inbytesleft, &outbuf, &outbytesleft);
+		if (ret == (size_t)-1 && errno != E2BIG) {
+			/* counted for the status line, only the first one is told */
+			static bool told;
+			metric_add(METRIC_ICONV_FAILED, 1);
+			if (tell && !__atomic_exchange_n(&told, true, __ATOMIC_RELAXED))
+				fprintf(stderr, "iconv() failed: %s\n", strerror(errno));
+			/*exit(1); // FIXME: handle errors*/
+		} // if
 
-	*r = '\0';
-	return result;
+		// Luckily '&<> are single byte character sequences in UTF-8 and no
+		// other character will have a UTF-8 sequence containing these
+		// patterns. Because the MSB is set in all multi-byte sequences, we can
+		// simply scan for '&<> and don't have to parse UTF-8 sequences.
+		strbuf_grow(out, 5 * (outbuf - buf));
+		out->len = put_xml_run(out->buf + out->len, buf, outbuf - buf) - out->buf;
+	} while (ret == (size_t)-1 && errno == E2BIG);
+} // decode_iconv
+
+/* Append the DVB string s of len bytes to out, converted to UTF-8 with the
+ * xml entities quoted.  Like the printf("%s") it used to be passed to, the
+ * text ends at a NUL character.  Returns the number of bytes appended, or
+ * -1 for a reserved character table or one iconv() doesn't have, which
+ * appends nothing.  Only with tell does what goes wrong go to stderr.
+ */
+static int convert(struct strbuf *out, const char *s, int len, int tell) {
+	char cs_new[16];
+	const char *start = s;
+	size_t old = out->len;
+
+	strbuf_grow(out, 5 * (len > 0 ? len : 0));
+	out->buf[out->len] = '\0';
+	if (len <= 0)
+		return 0;
+
+	uint64_t t = stage_start();
+	int i = (int)(unsigned char)s[0];
+  /* get the string encoding, then remove the first byte(s) */
+	if (encoding[i].handler(cs_new, &s, encoding[i].data)) {
+		if (tell)
+			fprintf(stderr, "Reserved encoding: %02x\n", i);
+		stage_end(STAGE_TEXT, t);
+		return -1;
+	}
+	len -= s - start;
+	if (len < 0)
+		len = 0;
+	struct cd_cache *c = get_cd(cs_new, tell);
+
+	forbidden = -1;
+	char *r = decode_native(c, s, len, out->buf + out->len);
+	metric_add(METRIC_TEXT, 1);
+	if (r)
+		out->len = r - out->buf;
+	else if (c->cd == (iconv_t)-1) {
+		out->buf[out->len = old] = '\0';
+		stage_end(STAGE_TEXT, t);
+		return -1;
+	} else {
+		metric_add(METRIC_ICONV, 1);
+		decode_iconv(out, c->cd, s, len, tell);
+	}
+	if (tell && forbidden >= 0)
+		fprintf(stderr, "Forbidden char %02x\n", forbidden);
+
+	r = memchr(out->buf + old, '\0', out->len - old);
+	if (r)
+		out->len = r - out->buf;
+	out->buf[out->len] = '\0';
+	stage_end(STAGE_TEXT, t);
+	return out->len - old;
+} // convert
+
+size_t xmlify(struct strbuf *out, const char *s, int len) {
+	int n = convert(out, s, len, 1);
+	return n < 0 ? 0 : n;
 } // xmlify
 
+/* Like xmlify(), but plain UTF-8 for other formats than XMLTV, and
+ * nothing on stderr.  The only entities put_xml() makes are &amp; &lt;
+ * and &gt;, and every '&' starts one of them, so they are simply turned
+ * back.  Returns -1 for text that can't be converted. */
+int dvb_text(struct strbuf *out, const char *s, int len) {
+	size_t old = out->len;
+	if (convert(out, s, len, 0) < 0)
+		return -1;
+	char *end = out->buf + out->len;
+	char *p = memchr(out->buf + old, '&', out->len - old), *q = p;
+	if (p == NULL)
+		return out->len - old;
+	while (p < end) {
+		if (*p != '&')
+			*q++ = *p++;
+		else if (p[1] == 'a') {
+			*q++ = '&';
+			p += 5;
+		} else {
+			*q++ = p[1] == 'l' ? '<' : '>';
+			p += 4;
+		} // if
+	} // while
+	out->len = q - out->buf;
+	out->buf[out->len] = '\0';
+	return out->len - old;
+} // dvb_text
+
 #ifdef MAIN
 int main(int argc, char **argv) {
-	if (argc > 1)
-		printf("%s\n%s\n", argv[1], xmlify(argv[1]));
+	struct strbuf out = STRBUF_INIT;
+	if (argc > 1) {
+		xmlify(&out, argv[1], strlen(argv[1]));
+		printf("%s\n%s\n", argv[1], out.buf);
+	} // if
 	return 0;
 } // main
 #endif
@@ -0,0 +1,122 @@
+/* dvbtime.c: DVB start times to XMLTV time stamps.
+ *
+ * EIT events give their start as a Modified Julian Date and a BCD time of
+ * day in UTC.  Both convert to a time_t with plain integer arithmetic,
+ * see BcdTimeToSeconds() in si_tables.h.  The text
+ * form "YYYYMMDDhhmmss +zzzz" needs the local UTC offset, which
+ * is looked up with localtime_r() once per UTC day and cached together
+ * with the formatted offset and date.  Days with a change to or from
+ * daylight saving time fall back to localtime_r() for every time on it. */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "tv_grab_dvb.h"
+
+#define DAY (24 * 60 * 60)
+#define DAY_CACHE 64              // any power of two, days seen at once
+
+static inline int64_t floor_div(int64_t a, int64_t b) {
+  return a / b - (a % b < 0);
+}
+
+/* Day number since 1970-01-01 to calendar date, proleptic Gregorian. {{{ */
+static void civil_from_days(int64_t z, int *year, int *month, int *day) {
+  z += 719468;
+  int64_t era = floor_div(z, 146097);
+  unsigned doe = z - era * 146097;
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *day = doy - (153 * mp + 2) / 5 + 1;
+  *month = mp < 10 ? mp + 3 : mp - 9;
+  *year = yoe + era * 400 + (*month <= 2);
+} /*}}}*/
+
+static void put_digits(char *p, unsigned v, int n) {
+  while (n--) {
+    p[n] = '0' + v % 10;
+    v /= 10;
+  }
+}
+
+/* UTC offsets, one entry per UTC day. */
+static __thread struct zone_day {
+  int64_t day;
+  long gmtoff;
+  bool valid, mixed;            // mixed: the offset changes during the day
+  char zone[8];                 // " +hhmm"
+} zone_cache[DAY_CACHE];
+
+/* Local dates, one entry per local day. */
+static __thread struct date_day {
+  int64_t day;
+  bool valid;
+  char date[8];                 // "YYYYMMDD"
+} date_cache[DAY_CACHE];
+
+static const struct zone_day *zone_day(int64_t day) {
+  struct zone_day *z = &zone_cache[day & (DAY_CACHE - 1)];
+  if (z->valid && z->day == day)
+    return z;
+  time_t t0 = day * DAY, t1 = t0 + DAY - 1;
+  struct tm tm0, tm1;
+  localtime_r(&t0, &tm0);
+  localtime_r(&t1, &tm1);
+  z->day = day;
+  z->gmtoff = tm0.tm_gmtoff;
+  z->mixed = tm0.tm_gmtoff != tm1.tm_gmtoff;
+  z->zone[0] = ' ';
+  strftime(z->zone + 1, sizeof(z->zone) - 1, "%z", &tm0);
+  z->valid = true;
+  return z;
+}
+
+/* NULL for years strftime() would not print with four digits. */
+static const char *date_day(int64_t day) {
+  struct date_day *d = &date_cache[day & (DAY_CACHE - 1)];
+  if (!d->valid || d->day != day) {
+    int year, month, mday;
+    civil_from_days(day, &year, &month, &mday);
+    if (year < 1000 || year > 9999)
+      return NULL;
+    put_digits(d->date, year, 4);
+    put_digits(d->date + 4, month, 2);
+    put_digits(d->date + 6, mday, 2);
+    d->day = day;
+    d->valid = true;
+  }
+  return d->date;
+}
+
+/* Format t as local "YYYYMMDDhhmmss +zzzz" into buf, return its length. {{{
+ * Same as strftime("%Y%m%d%H%M%S %z", localtime(&t)) for the years
+ * 1000 to 9999. */
+size_t xmltv_time(char *buf, size_t size, time_t t) {
+  const struct zone_day *z = zone_day(floor_div(t, DAY));
+  if (z->mixed) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return strftime(buf, size, "%Y%m%d%H%M%S %z", &tm);
+  }
+  size_t zlen = strlen(z->zone);
+  if (size < 14 + zlen + 1)
+    return 0;
+  int64_t local = (int64_t)t + z->gmtoff;
+  int64_t day = floor_div(local, DAY);
+  unsigned sec = local - day * DAY;
+  const char *date = date_day(day);
+  if (date == NULL) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return strftime(buf, size, "%Y%m%d%H%M%S %z", &tm);
+  }
+  memcpy(buf, date, 8);
+  put_digits(buf + 8, sec / 3600, 2);
+  put_digits(buf + 10, sec / 60 % 60, 2);
+  put_digits(buf + 12, sec % 60, 2);
+  memcpy(buf + 14, z->zone, zlen + 1);
+  return 14 + zlen;
+} /*}}}*/
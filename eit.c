@@ -0,0 +1,276 @@
+/* eit.c: the descriptors of an EIT event, as fields of a programme.
+ *
+ * Text fields point at the bytes of the section, still in the broadcast
+ * encoding, and other fields keep the codes as broadcast; turning them
+ * into text is up to the writers, or to the caller of libepgrab.  The
+ * section has to stay around for as long as the fields are used. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+/* Add a field to the programme. {{{ */
+static struct epgrab_field *addField(struct programme *p, enum epgrab_field_type type, const u_char *lang) {
+  struct epgrab_field *f = &p->field[p->count++];
+  memset(f, 0, sizeof(*f));
+  f->type = type;
+  if (lang)
+    memcpy(f->lang, lang, 3);
+  p->types |= 1 << type;
+  return f;
+} /*}}}*/
+
+static inline void setText(struct epgrab_field *f, const void *text, int len) {
+  f->text = text;
+  f->len = len;
+}
+
+/* Parse 0x4D Short Event Descriptor. {{{
+ * Returns false if its texts run past its end. */
+static bool parseEventDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x4D);
+  struct descr_short_event *evtdesc = data;
+  void *data_end = data + DESCR_GEN_LEN + GetDescriptorLength(data);
+
+  if (GetDescriptorLength(data) < DESCR_SHORT_EVENT_LEN - DESCR_GEN_LEN)
+    return false;
+  int evtlen = evtdesc->event_name_length;
+  if ((void *)&evtdesc->data + evtlen + 1 > data_end ||
+      (void *)&evtdesc->data + evtlen + 1 + evtdesc->data[evtlen] > data_end)
+    return false;
+  if (evtlen)
+    setText(addField(p, EPGRAB_TITLE, &evtdesc->lang_code1), &evtdesc->data, evtlen);
+
+  int dsclen = evtdesc->data[evtlen];
+  const char *dsc = (char *)&evtdesc->data[evtlen+1];
+  if (dsclen && *dsc)
+    setText(addField(p, EPGRAB_SUB_TITLE, &evtdesc->lang_code1), dsc, dsclen);
+  return true;
+} /*}}}*/
+
+/* Parse 0x4E Extended Event Descriptor. {{{
+ * One desc may be spread over several of them, numbered from 0.
+ * Returns false if its items or text run past its end, with what came
+ * before added. */
+static bool parseLongEventDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x4E);
+  struct descr_extended_event *levt = data;
+  void *data_end = data + DESCR_GEN_LEN + GetDescriptorLength(data);
+  void *items_end = (void *)levt->data + levt->length_of_items;
+  if (GetDescriptorLength(data) < DESCR_EXTENDED_EVENT_LEN - DESCR_GEN_LEN ||
+      items_end + ITEM_EXTENDED_EVENT_LEN > data_end)
+    return false; // no room for the text after the items
+  bool non_empty = (levt->descriptor_number || levt->last_descriptor_number || levt->length_of_items || levt->data[0]);
+
+  if (non_empty && levt->descriptor_number == 0)
+    addField(p, EPGRAB_DESC, &levt->lang_code1);
+
+  void *q = &levt->data;
+  while (q < items_end) {
+    struct item_extended_event *name = q;
+    int name_len = name->item_description_length;
+    if (q + ITEM_EXTENDED_EVENT_LEN + name_len + ITEM_EXTENDED_EVENT_LEN > items_end)
+      return false; // no room for the value either
+    struct epgrab_field *f = addField(p, EPGRAB_DESC_TEXT, NULL);
+    setText(f, &name->data, name_len);
+    f->code = ':';
+
+    q += ITEM_EXTENDED_EVENT_LEN + name_len;
+
+    struct item_extended_event *value = q;
+    int value_len = value->item_description_length;
+    if (q + ITEM_EXTENDED_EVENT_LEN + value_len > items_end)
+      return false;
+    f = addField(p, EPGRAB_DESC_TEXT, NULL);
+    setText(f, &value->data, value_len);
+    f->code = ';';
+
+    q += ITEM_EXTENDED_EVENT_LEN + value_len;
+  }
+  struct item_extended_event *text = q;
+  int len = text->item_description_length;
+  if (q + ITEM_EXTENDED_EVENT_LEN + len > data_end)
+    return false;
+  if (non_empty && len)
+    setText(addField(p, EPGRAB_DESC_TEXT, NULL), &text->data, len);
+
+  if (non_empty && levt->descriptor_number == levt->last_descriptor_number)
+    addField(p, EPGRAB_DESC_END, NULL);
+  return true;
+} /*}}}*/
+
+/* Parse 0x50 Component Descriptor. {{{ */
+static void parseComponentDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x50);
+  struct descr_component *dc = data;
+  struct epgrab_field *f = addField(p, EPGRAB_COMPONENT, &dc->lang_code1);
+  f->code = dc->stream_content;
+  f->code2 = dc->component_type;
+} /*}}}*/
+
+static inline void set_bit(int *bf, int b) {
+  int i = b / 8 / sizeof(int);
+  int s = b % (8 * sizeof(int));
+  bf[i] |= (1 << s);
+}
+
+static inline bool get_bit(int *bf, int b) {
+  int i = b / 8 / sizeof(int);
+  int s = b % (8 * sizeof(int));
+  return bf[i] & (1 << s);
+}
+
+/* Parse 0x54 Content Descriptor. {{{ */
+static void parseContentDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x54);
+  struct descr_content *dc = data;
+  int once[256/8/sizeof(int)] = {0,};
+  void *q;
+  for (q = &dc->data; q < data + dc->descriptor_length; q += NIBBLE_CONTENT_LEN) {
+    struct nibble_content *nc = q;
+    int c1 = (nc->content_nibble_level_1 << 4) + nc->content_nibble_level_2;
+    int c2 = (nc->user_nibble_1 << 4) + nc->user_nibble_2;
+    if (c1 > 0 && !get_bit(once, c1)) {
+      set_bit(once, c1);
+      struct epgrab_field *f = addField(p, EPGRAB_CATEGORY, NULL);
+      f->code = c1;
+      f->code2 = c2;
+    }
+    // This is weird in the uk, they use user but not content, and almost the same values
+  }
+} /*}}}*/
+
+/* Parse 0x55 Rating Descriptor. {{{ */
+static void parseRatingDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x55);
+  struct descr_parental_rating *pr = data;
+  void *q;
+  for (q = &pr->data; q < data + pr->descriptor_length; q += PARENTAL_RATING_ITEM_LEN) {
+    struct parental_rating_item *pr = q;
+    if (pr->rating) // 0x00 is undefined
+      addField(p, EPGRAB_RATING, &pr->lang_code1)->code = pr->rating;
+  }
+} /*}}}*/
+
+/* Parse 0x5F Private Data Specifier. {{{ */
+static int parsePrivateDataSpecifier(void *data) {
+  assert(GetDescriptorTag(data) == 0x5F);
+  return GetPrivateDataSpecifier(data);
+} /*}}}*/
+
+/* Parse 0x76 Content Identifier Descriptor. {{{
+ * See ETSI TS 102 323, section 12.  Returns false if a CRID runs past
+ * its end, with those before added. */
+static bool parseContentIdentifierDescription(struct programme *p, void *data) {
+  assert(GetDescriptorTag(data) == 0x76);
+  struct descr_content_identifier *ci = data;
+  void *data_end = data + DESCR_GEN_LEN + GetDescriptorLength(data);
+  void *q;
+  for (q = &ci->data; q < data_end; /* at end */) {
+    struct descr_content_identifier_crid *crid = q;
+    struct descr_content_identifier_crid_local *crid_data;
+
+    int crid_length = 3;
+
+    switch (crid->crid_location)
+    {
+      case 0x00: /* Carried explicitly within descriptor */
+        crid_data = (descr_content_identifier_crid_local_t *)&crid->crid_ref_data;
+        if (q + 2 > data_end || q + 2 + crid_data->crid_length > data_end)
+          return false;
+        struct epgrab_field *f = addField(p, EPGRAB_CRID, NULL);
+        setText(f, &crid_data->crid_byte, crid_data->crid_length);
+        f->code = crid->crid_type;
+        crid_length = 2 + crid_data->crid_length;
+        break;
+      case 0x01: /* Carried in Content Identifier Table (CIT) */
+        if (q + crid_length > data_end)
+          return false;
+        break;
+      default:
+        break;
+    }
+
+    q += crid_length;
+  }
+  return true;
+} /*}}}*/
+
+/* Decode the descriptor loop of an event. {{{
+ * Returns 1 if it has a non-empty title, as xmltv.dtd requires, 0 if
+ * not, and -1 for a descriptor running past its end or that of the
+ * loop, where the decoding stops. */
+int eit_describe(struct programme *p, const void *descriptors, size_t len) {
+  void *data = (void *)descriptors;
+  int pds = 0;
+  void *q;
+  p->count = 0;
+  p->types = 0;
+  for (q = data; q < data + len; q += DESCR_GEN_LEN + GetDescriptorLength(q)) {
+    struct descr_gen *desc = q;
+    if (q + DESCR_GEN_LEN > data + len || q + DESCR_GEN_LEN + GetDescriptorLength(q) > data + len)
+      return -1;
+    switch (GetDescriptorTag(desc)) {
+      case 0:
+        break;
+      case 0x4D: //short evt desc, [title] [sub-title]
+        // there can be multiple language versions of these
+        if (!parseEventDescription(p, desc))
+          return -1;
+        break;
+      case 0x4E: //long evt descriptor [desc]
+        if (!parseLongEventDescription(p, desc))
+          return -1;
+        break;
+      case 0x50: //component desc [language] [video] [audio] [subtitles]
+        parseComponentDescription(p, desc);
+        break;
+      case 0x53: // CA Identifier Descriptor
+        break;
+      case 0x54: // content desc [category]
+        parseContentDescription(p, desc);
+        break;
+      case 0x55: // Parental Rating Descriptor [rating]
+        parseRatingDescription(p, desc);
+        break;
+      case 0x5f: // Private Data Specifier
+        pds = parsePrivateDataSpecifier(desc);
+        break;
+      case 0x64: // Data broadcast desc - Text Desc for Data components
+        break;
+      case 0x69: // Programm Identification Label
+        break;
+      case 0x81: // TODO ???
+        if (pds == 5) // ARD_ZDF_ORF
+          break;
+      case 0x82: // VPS (ARD, ZDF, ORF)
+        if (pds == 5) // ARD_ZDF_ORF
+          // TODO: <programme @vps-start="???">
+          break;
+      case 0x4F: // Time Shifted Event
+      case 0x52: // Stream Identifier Descriptor
+      case 0x5E: // Multi Lingual Component Descriptor
+      case 0x83: // Logical Channel Descriptor (some kind of news-ticker on ARD-MHP-Data?)
+      case 0x84: // Preferred Name List Descriptor
+      case 0x85: // Preferred Name Identifier Descriptor
+      case 0x86: // Eacem Stream Identifier Descriptor
+        break;
+      case 0x76: // Content identifier descriptor
+        if (!parseContentIdentifierDescription(p, desc))
+          return -1;
+        break;
+      default: {
+        struct epgrab_field *f = addField(p, EPGRAB_UNKNOWN, NULL);
+        f->code = GetDescriptorTag(desc);
+        f->code2 = GetDescriptorLength(desc);
+      }
+    }
+  }
+  return (p->types & (1 << EPGRAB_TITLE)) != 0;
+} /*}}}*/
@@ -0,0 +1,108 @@
+/* epgrab.c: the libepgrab entry points, see epgrab.h.
+ *
+ * A section is checked and its events are walked like parseEIT() in
+ * tv_grab_dvb.c does, each decoded into the context's programme with
+ * eit_describe(), whose fields are what the view points at.  Nothing is
+ * kept between calls but that scratch space.
+ *
+ * The library is only the decoding, without stats.c: the counters and
+ * stage timers dvb_text_iconv.c feeds are left empty here. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+void metric_add(enum metric m, int n) {
+  (void)m;
+  (void)n;
+}
+
+uint64_t stage_start(void) {
+  return 0;
+}
+
+void stage_end(enum stage s, uint64_t start) {
+  (void)s;
+  (void)start;
+}
+
+struct epgrab {
+  epgrab_event_cb event;
+  void *arg;
+  struct programme prog;  // the fields of the event passed on
+};
+
+struct epgrab *epgrab_new(epgrab_event_cb event, void *arg) {
+  struct epgrab *g = calloc(1, sizeof(*g));
+  if (g == NULL)
+    return NULL;
+  g->event = event;
+  g->arg = arg;
+  return g;
+}
+
+void epgrab_free(struct epgrab *g) {
+  free(g);
+}
+
+/* Decode a section and pass on all of its events. {{{ */
+int epgrab_feed(struct epgrab *g, const void *sec, size_t len) {
+  const struct eit *e = sec;
+  const uint8_t *p, *end;
+  int n = 0;
+
+  if (len < EIT_LEN + 4 || e->table_id < 0x4E || e->table_id > 0x6F ||
+      GetSectionLength(e) + 3 != len || _dvb_crc32(sec, len) != 0)
+    return -1;
+  end = (const uint8_t *)sec + len - 4; // without the CRC
+  for (p = (const uint8_t *)&e->data; p + EIT_EVENT_LEN <= end; p += EIT_EVENT_LEN + GetEITDescriptorsLoopLength(p)) {
+    const struct eit_event *evt = (const struct eit_event *)p;
+    size_t loop = GetEITDescriptorsLoopLength(evt);
+    if (p + EIT_EVENT_LEN + loop > end)
+      break;
+    if (eit_describe(&g->prog, &evt->data, loop) < 0)
+      return -1; // a broken descriptor, despite the CRC
+
+    struct epgrab_event ev = {
+      .onid = HILO(e->original_network_id),
+      .tsid = HILO(e->transport_stream_id),
+      .sid = HILO(e->service_id),
+      .eid = HILO(evt->event_id),
+      .table_id = e->table_id,
+      .version = e->version_number,
+      .running_status = evt->running_status,
+      .count = g->prog.count,
+      .field = g->prog.field,
+    };
+    ev.start = (time_t)(HILO(evt->mjd) - 40587) * 24*60*60 + BcdTimeToSeconds(evt->start_time);
+    ev.stop = ev.start + BcdTimeToSeconds(evt->duration);
+    g->event(&ev, g->arg);
+    n++;
+  }
+  return n;
+} /*}}}*/
+
+/* Convert the text of a field only now. {{{ */
+int epgrab_text(const struct epgrab_field *f, char *buf, size_t size) {
+  static __thread struct strbuf sb = STRBUF_INIT;
+  int n = 0;
+  sb.len = 0;
+  if (f->text && f->len)
+    n = dvb_text(&sb, f->text, f->len);
+  if (n < 0) {
+    if (size)
+      buf[0] = '\0';
+    return -1;
+  }
+  if (size) {
+    size_t c = (size_t)n < size ? (size_t)n : size - 1;
+    if (c)
+      memcpy(buf, sb.buf, c);
+    buf[c] = '\0';
+  }
+  return n;
+} /*}}}*/
@@ -0,0 +1,71 @@
+/* epgrab.h: libepgrab, the EIT decoding of epgrab for other programs.
+ *
+ * A context is fed complete sections, as read from a demux device or a
+ * transport stream, and hands every event of them to a callback.  The
+ * event is a view: its fields point into the section fed, with the text
+ * in the broadcast encoding, so nothing is converted unless asked for
+ * with epgrab_text().  The view and its fields are only good until the
+ * callback returns.
+ *
+ * Contexts are independent, one per thread can feed at the same time.
+ * Repeats are not filtered, every section fed is decoded. */
+#ifndef EPGRAB_H
+#define EPGRAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+enum epgrab_field_type {
+	EPGRAB_TITLE = 1,    /* lang, text */
+	EPGRAB_SUB_TITLE,    /* lang, text */
+	EPGRAB_DESC,         /* lang, EPGRAB_DESC_TEXT up to EPGRAB_DESC_END follow */
+	EPGRAB_CATEGORY,     /* code content_nibble_level_1 << 4 | level_2, code2 user_byte */
+	EPGRAB_COMPONENT,    /* code stream_content, code2 component_type, lang */
+	EPGRAB_RATING,       /* code rating, lang country_code */
+	EPGRAB_CRID,         /* code crid_type, text */
+	EPGRAB_DESC_TEXT,    /* text, code the separator following it, or 0 */
+	EPGRAB_DESC_END,
+	EPGRAB_UNKNOWN,      /* code descriptor_tag, code2 descriptor_length */
+};
+struct epgrab_field {
+	const char *text;   /* DVB string, still in the broadcast encoding */
+	uint8_t len;
+	uint8_t type;       /* enum epgrab_field_type */
+	uint8_t code;
+	uint8_t code2;
+	char lang[3];       /* ISO 639-2, as broadcast */
+};
+
+struct epgrab_event {
+	int onid, tsid, sid, eid;
+	int table_id;
+	int version;         /* version_number of the section */
+	int running_status;
+	time_t start, stop;  /* UTC */
+	int count;           /* of fields */
+	const struct epgrab_field *field; /* in descriptor order */
+};
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define EPGRAB_API __attribute__((visibility("default")))
+#else
+#define EPGRAB_API
+#endif
+
+struct epgrab;
+typedef void (*epgrab_event_cb)(const struct epgrab_event *ev, void *arg);
+
+extern EPGRAB_API struct epgrab *epgrab_new(epgrab_event_cb event, void *arg);
+extern EPGRAB_API void epgrab_free(struct epgrab *g);
+/* Returns the number of events passed on, -1 for a section that is not
+ * an EIT one, fails its CRC check or has a descriptor running past its
+ * end; the events before that one have been passed on then. */
+extern EPGRAB_API int epgrab_feed(struct epgrab *g, const void *sec, size_t len);
+/* The text of a field in UTF-8, NUL-terminated in buf like snprintf(),
+ * returning the length it needs; -1, with buf empty, if its character
+ * table is a reserved one or not supported by iconv(3). */
+extern EPGRAB_API int epgrab_text(const struct epgrab_field *f, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,136 @@
+/* events.c: table of events already seen, keyed by
+ * (original_network_id, service_id, event_id).
+ *
+ * Open addressing with linear probing.  All slots live in a single
+ * allocation, which is doubled and rehashed when it gets 3/4 full, so
+ * adding an event never costs a malloc of its own.
+ *
+ * The table is shared by the threads reading several demux devices, so
+ * an event sent on more than one transport stream is only output once.
+ * A lookup is a few probes, short enough for a single lock.
+ *
+ * Each event keeps its stop time, so a long running daemon can forget
+ * the ones that are over, see events_expire(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tv_grab_dvb.h"
+
+#define EVENTS_MIN_SIZE 1024
+
+struct event_slot {
+  uint16_t onid;
+  uint16_t sid;
+  uint16_t eid;
+  uint8_t ver;
+  uint8_t used;
+  uint32_t stop;  // time_t, unsigned to last until 2106
+};
+
+static struct event_slot *slots;
+static size_t size, count;
+static struct arena memory = ARENA_INIT("event table"); // counted only
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t event_hash(uint16_t onid, uint16_t sid, uint16_t eid) {
+  uint64_t k = ((uint64_t)onid << 32) | ((uint64_t)sid << 16) | eid;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static struct event_slot *event_find(struct event_slot *t, size_t n, uint16_t onid, uint16_t sid, uint16_t eid) {
+  size_t i = event_hash(onid, sid, eid) & (n - 1);
+  while (t[i].used && (t[i].onid != onid || t[i].sid != sid || t[i].eid != eid))
+    i = (i + 1) & (n - 1);
+  return &t[i];
+}
+
+/* Re-insert all live slots stopping at or after before into n slots. {{{ */
+static int event_rehash(size_t n, time_t before) {
+  struct event_slot *t = calloc(n, sizeof(struct event_slot));
+  if (t == NULL)
+    return -1;
+  size_t i;
+  count = 0;
+  for (i = 0; i < size; i++)
+    if (slots[i].used && slots[i].stop >= before) {
+      *event_find(t, n, slots[i].onid, slots[i].sid, slots[i].eid) = slots[i];
+      count++;
+    }
+  free(slots);
+  slots = t;
+  size = n;
+  arena_count(&memory, count * sizeof(struct event_slot), size * sizeof(struct event_slot));
+  return 0;
+} /*}}}*/
+
+/* Double the table. {{{ */
+static int event_grow(void) {
+  return event_rehash(size ? size * 2 : EVENTS_MIN_SIZE, 0);
+} /*}}}*/
+
+/* version_number is a 5 bit counter, which wraps from 31 back to 0.
+ * Treat the next 15 values as newer, the others as old repeats. */
+static inline bool version_newer(int ver, int old) {
+  int d = (ver - old) & 0x1f;
+  return d > 0 && d < 16;
+}
+
+/* Has the event been recorded in this run? */
+bool event_known(int onid, int sid, int eid) {
+  bool known;
+  pthread_mutex_lock(&lock);
+  known = size && event_find(slots, size, onid, sid, eid)->used;
+  pthread_mutex_unlock(&lock);
+  return known;
+}
+
+/* Record an event and report whether it is new, a repeat or an update. {{{ */
+enum event_state event_update(int onid, int sid, int eid, int ver, time_t stop) {
+  enum event_state state = EVENT_NEW;
+  pthread_mutex_lock(&lock);
+  if (4 * (count + 1) > 3 * size && event_grow() < 0) {
+    fprintf(stderr, "Out of memory for event table\n");
+    exit(1);
+  }
+
+  struct event_slot *s = event_find(slots, size, onid, sid, eid);
+  if (!s->used) {
+    s->onid = onid;
+    s->sid = sid;
+    s->eid = eid;
+    s->ver = ver;
+    s->used = 1;
+    s->stop = stop;
+    count++;
+    arena_count(&memory, count * sizeof(struct event_slot), size * sizeof(struct event_slot));
+  } else if (!version_newer(ver, s->ver)) {
+    state = EVENT_SEEN; // seen it before or it's older
+  } else {
+    s->ver = ver;
+    s->stop = stop;
+    state = EVENT_UPDATED;
+  }
+  pthread_mutex_unlock(&lock);
+  return state;
+} /*}}}*/
+
+/* Forget the events stopping before a time, returns how many are left. {{{
+ * The table shrinks back while it is less than 1/4 full. */
+size_t events_expire(time_t before) {
+  pthread_mutex_lock(&lock);
+  if (size && event_rehash(size, before) == 0) {
+    size_t n = size;
+    while (n > EVENTS_MIN_SIZE && 4 * count < n)
+      n /= 2;
+    if (n != size)
+      event_rehash(n, before); // stays big if that fails
+  }
+  size_t left = count;
+  pthread_mutex_unlock(&lock);
+  return left;
+} /*}}}*/
@@ -0,0 +1,174 @@
+/* input.c: section data from a file, pipe or demux device.
+ *
+ * Regular files are mapped as a whole and parsed in place.  Everything
+ * else is read into one large buffer.  Sections are parsed where they
+ * landed; only when the free space at the end gets short is the unparsed
+ * tail, at most one partial section or packet, moved to the front.
+ *
+ * A demux device is opened non-blocking and waited for with poll() until
+ * the deadline set with input_timeout().  When the kernel buffer ran
+ * over, read() fails once with EOVERFLOW; that is counted and reading
+ * carries on with what arrived since.
+ *
+ * With several section filters on one demux device every filter has an
+ * fd and buffer of its own, as a read() may end within a section, and
+ * input_poll() reads whichever of them has data. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
+
+#include "tv_grab_dvb.h"
+
+#define INPUT_SIZE (1 << 20)
+#define INPUT_MIN  (1 << 16)  // read at least this much at a time
+
+/* Map fd if it is a regular file, else set up the read buffer. {{{
+ * The buffer has size bytes, or a default size for 0. */
+int input_open(struct input *in, int fd, size_t size) {
+  struct stat st;
+  memset(in, 0, sizeof(*in));
+  in->fd = fd;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      madvise(m, st.st_size, MADV_SEQUENTIAL);
+      in->buf = m;
+      in->len = st.st_size;
+      in->mapped = true;
+      return 0;
+    }
+  }
+  if (size == 0)
+    size = INPUT_SIZE;
+  if (size < 2 * INPUT_MIN)
+    size = 2 * INPUT_MIN;
+  in->buf = malloc(size);
+  if (in->buf == NULL)
+    return -1;
+  in->size = size;
+  return 0;
+} /*}}}*/
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Give up waiting for data seconds from now, 0 to wait forever. */
+void input_timeout(struct input *in, int seconds) {
+  in->deadline = seconds ? now_ms() + seconds * 1000 : 0;
+}
+
+/* Read what is there without waiting. {{{
+ * Returns the number of bytes read, 0 at the end, -1 on errors, with
+ * errno EAGAIN if there is nothing yet. */
+static ssize_t input_read(struct input *in) {
+  if (in->size - in->len < INPUT_MIN) {
+    memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+    in->len -= in->pos;
+    in->pos = 0;
+  }
+  for (;;) {
+    ssize_t r = read(in->fd, in->buf + in->len, in->size - in->len);
+    if (r >= 0) {
+      in->len += r;
+      return r;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EOVERFLOW) {
+      metric_add(METRIC_OVERFLOWS, 1);
+      continue;
+    }
+    return -1;
+  }
+} /*}}}*/
+
+/* Milliseconds to wait for the deadline, -1 for ever, 0 if it passed. */
+static int input_wait(const struct input *in) {
+  if (in->deadline == 0)
+    return -1;
+  int64_t left = in->deadline - now_ms();
+  return left > 0 ? left : 0;
+}
+
+/* Read more data after what is still unparsed. {{{
+ * Returns the number of bytes read, 0 at the end or when the deadline
+ * passed, -1 on errors. */
+ssize_t input_fill(struct input *in) {
+  if (in->mapped)
+    return 0;
+  for (;;) {
+    ssize_t r = input_read(in);
+    if (r >= 0 || errno != EAGAIN)
+      return r;
+
+    int wait = input_wait(in);
+    if (wait == 0)
+      return 0;
+    struct pollfd pfd = { .fd = in->fd, .events = POLLIN };
+    int n = poll(&pfd, 1, wait);
+    if (n == 0)
+      return 0;
+    if (n < 0 && errno != EINTR)
+      return -1;
+  }
+} /*}}}*/
+
+/* Read more data from whichever of n inputs has some. {{{
+ * The demux filters of one device, up to the deadline of the first.  The
+ * one read is returned in *which; the next call starts looking after it,
+ * so a busy filter cannot starve the others.  Returns like input_fill(). */
+ssize_t input_poll(struct input *in, int n, int *which) {
+  struct pollfd pfd[n];
+  int i;
+  if (n == 1) {
+    *which = 0;
+    return input_fill(in);
+  }
+  for (i = 0; i < n; i++) {
+    pfd[i].fd = in[i].fd;
+    pfd[i].events = POLLIN;
+  }
+  for (;;) {
+    int wait = input_wait(in);
+    int ready = poll(pfd, n, wait);
+    if (ready == 0)
+      return 0;
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    for (i = 1; i <= n; i++) {
+      int k = (*which + i) % n;
+      if (!pfd[k].revents)
+        continue;
+      ssize_t r = input_read(&in[k]);
+      if (r >= 0 || errno != EAGAIN) {
+        *which = k;
+        return r;
+      }
+    }
+    if (wait == 0)
+      return 0; // nothing after all, and the deadline passed
+  }
+} /*}}}*/
+
+void input_close(struct input *in) {
+  if (in->mapped)
+    munmap(in->buf, in->len);
+  else
+    free(in->buf);
+  in->buf = NULL;
+}
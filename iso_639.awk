@@ -1,8 +1,25 @@
 #! /usr/bin/awk -f
+# Turn iso_639.tab into a perfect hash from the ISO 639-2 codes to the
+# ISO 639-1 codes for lookup_language().
+#
+# Hash and displace: the key k is the three bytes of the code.  It picks a
+# bucket with (k * LANG_MULT) % LANG_PRIME, which picks a multiplier m, and
+# (k * m) % LANG_PRIME selects the slot.  The multipliers are searched here
+# so that no two codes share a slot.  k * m stays below 2^53, so awk's
+# doubles compute the same as the uint64_t arithmetic in C.
+function mult(d)
+{
+	return 1 + (d * 16777619) % PRIME
+}
 BEGIN \
 {
-	print "#include \"tv_grab_dvb.h\""
-	print "const struct lookup_table languageid_table[] = {"
+	PRIME = 536870909
+	MULT = 387420489
+	BUCKETS = 64
+	SLOTS = 512
+	for (i = 1; i < 256; i++)
+		ord[sprintf("%c", i)] = i
+	n = 0
 }
 /^#/ \
 {
@@ -16,15 +33,103 @@ $3 == "XX" \
 {
 	next
 }
+function add(code, name,    k)
 {
-	print "\t{{.c=\""$1"\"}, \""$3"\"},"
+	if (code in known)
+		return
+	known[code] = 1
+	k = ord[substr(code, 1, 1)] + ord[substr(code, 2, 1)] * 256 + ord[substr(code, 3, 1)] * 65536
+	codes[n] = code
+	names[n] = name
+	keys[n] = k
+	b = (k * MULT) % PRIME % BUCKETS
+	members[b, size[b]++] = n
+	n++
+}
+{
+	add($1, $3)
 }
 $1 != $2 \
 {
-	print "\t{{.c=\""$2"\"}, \""$3"\"},"
+	add($2, $3)
 }
 END \
 {
-	print "\t{{-1}, NULL},"
+	if (n > SLOTS / 2) {
+		print "iso_639.awk: too many codes, raise SLOTS" > "/dev/stderr"
+		exit 1
+	}
+	# place the biggest buckets first, while there are many free slots
+	for (left = BUCKETS; left > 0; left--) {
+		best = -1
+		for (b = 0; b < BUCKETS; b++)
+			if (!(b in done) && (best < 0 || size[b] > size[best]))
+				best = b
+		done[best] = 1
+		seed[best] = 0
+		if (!size[best])
+			continue
+		for (d = 1; d < 65536; d++) {
+			m = mult(d)
+			split("", try)
+			ok = 1
+			for (j = 0; j < size[best] && ok; j++) {
+				s = (keys[members[best, j]] * m) % PRIME % SLOTS
+				if ((s in slot) || (s in try))
+					ok = 0
+				try[s] = members[best, j]
+			}
+			if (ok)
+				break
+		}
+		if (!ok) {
+			print "iso_639.awk: no perfect hash found" > "/dev/stderr"
+			exit 1
+		}
+		seed[best] = d
+		for (s in try)
+			slot[s] = try[s]
+	}
+
+	print "#include <stdint.h>"
+	print "#include <string.h>"
+	print ""
+	print "#include \"tv_grab_dvb.h\""
+	print ""
+	print "#define LANG_PRIME " PRIME
+	print "#define LANG_MULT " MULT
+	print "#define LANG_BUCKETS " BUCKETS
+	print "#define LANG_SLOTS " SLOTS
+	print ""
+	print "static const uint16_t lang_seed[LANG_BUCKETS] = {"
+	for (b = 0; b < BUCKETS; b += 8) {
+		line = "\t"
+		for (i = b; i < b + 8; i++)
+			line = line seed[i] ","
+		print line
+	}
+	print "};"
+	print ""
+	print "static const struct {"
+	print "\tchar code[4];"
+	print "\tconst char *name;"
+	print "} lang_slot[LANG_SLOTS] = {"
+	for (s = 0; s < SLOTS; s++)
+		if (s in slot)
+			print "\t[" s "] = {\"" codes[slot[s]] "\", \"" names[slot[s]] "\"},"
 	print "};"
+	print ""
+	print "/* ISO 639-1 code for the three letter code, NULL if unknown. */"
+	print "const char *lookup_language(const char *code) {"
+	print "\tconst unsigned char *c = (const unsigned char *)code;"
+	print "\tuint64_t k = c[0] | (c[1] << 8) | (c[2] << 16);"
+	print "\tunsigned d = lang_seed[k * LANG_MULT % LANG_PRIME % LANG_BUCKETS];"
+	print "\tif (!d)"
+	print "\t\treturn NULL;"
+	print "\tuint64_t m = 1 + (uint64_t)d * 16777619 % LANG_PRIME;"
+	print "\tunsigned s = k * m % LANG_PRIME % LANG_SLOTS;"
+	print "\tif (lang_slot[s].name && !memcmp(lang_slot[s].code, code, 3))"
+	print "\t\treturn lang_slot[s].name;"
+	print "\treturn NULL;"
+	print "}"
 }
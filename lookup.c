@@ -1,18 +1,35 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "tv_grab_dvb.h"
 
-char *lookup(const struct lookup_table *l, int id) {
-//	printf("Looked up %x", id);
-	while ((l->u.i != id) && (l->u.i != -1))
-		l++;
-	return l->desc;
+/* Binary search in a table of n entries sorted by load_lookup().
+ * With duplicate ids the first one from the file wins, as it always did. */
+char *lookup(const struct lookup_table *l, int n, int id) {
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (l[mid].u.i < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < n && l[lo].u.i == id ? l[lo].desc : NULL;
+}
+
+/* Strings are stored in file order, so their address breaks ties. */
+static int compare_lookup(const void *a, const void *b) {
+	const struct lookup_table *x = a, *y = b;
+	if (x->u.i != y->u.i)
+		return x->u.i < y->u.i ? -1 : 1;
+	return x->desc < y->desc ? -1 : x->desc > y->desc;
 }
 
 /* Read lookup_table from file into newly allocated table.
  * The table is a single allocation consisting of two parts:
- * first the array of structs, followed by a char-array of strings. */
+ * first the array of structs, followed by a char-array of strings.
+ * Entries are sorted by id for lookup(); returns their number or -1. */
 int load_lookup(struct lookup_table **l, const char *file) {
 	int name;
 	char value[256];
@@ -47,16 +64,19 @@ int load_lookup(struct lookup_table **l, const char *file) {
 	p->desc = NULL;
 
 	fclose(fd);
-	return 0;
+	n = p - *l;
+	qsort(*l, n, sizeof(struct lookup_table), compare_lookup);
+	return n;
 }
 
 #ifdef MAIN
 int main(int argc; char **argv;) {
 	struct lookup_table *t;
-	if (load_lookup(&t, "chanidents") != 0)
+	int n = load_lookup(&t, "chanidents");
+	if (n < 0)
 		return -1;
 	if (argc > 1)
-		printf("%s\n", lookup(t, atoi(argv[1])));
+		printf("%s\n", lookup(t, n, atoi(argv[1])));
 	return 0;
 }
 #endif
@@ -0,0 +1,243 @@
+/* output.c: buffered output, XMLTV or binary.
+ *
+ * The emitters append to one large buffer, mostly fixed tag fragments of
+ * known length, instead of going through printf for every element.  The
+ * buffer is handed to write() once every OUTPUT_BATCH programmes or when
+ * it gets big, always at the end of a programme, so the file never
+ * contains half an element until the very end.
+ *
+ * With output_init(true) the file is switched to O_DIRECT and written in
+ * multiples of OUTPUT_ALIGN from an aligned buffer, keeping the rest for
+ * the next flush.  Only regular files are switched; where the file
+ * system refuses O_DIRECT, the output falls back to normal writes.
+ *
+ * Every thread has a buffer of its own and hands it over under a lock,
+ * so the programmes of several demux devices end up in one document,
+ * whole programmes at a time.  With O_DIRECT the hand-over goes through
+ * one shared aligned buffer, which keeps the part not filling a block.
+ *
+ * The XMLTV channels have to come before all programmes, but are only
+ * known once the SDT is in.  Until output_release() everything flushed
+ * is held back in memory, after the head written before output_hold().
+ * Should the SDT not come, a bounded hold ends by itself after
+ * OUTPUT_HOLD_TIME or OUTPUT_HOLD_SIZE held, with the channels known by
+ * then.
+ *
+ * With --compress the bytes written are those of compress.c, fed at the
+ * same boundaries, so the file can be decompressed as it grows. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "tv_grab_dvb.h"
+
+#define OUTPUT_BATCH 64               // programmes per write
+#define OUTPUT_SIZE  (256 * 1024)     // or bytes, whichever comes first
+#define OUTPUT_ALIGN 4096
+#define OUTPUT_HOLD_TIME 30           // seconds to hold at most
+#define OUTPUT_HOLD_SIZE (64 << 20)   // bytes
+
+__thread struct strbuf output = STRBUF_INIT;
+static __thread int pending;          // programmes since the last write
+static struct strbuf file = STRBUF_INIT; // aligned, for O_DIRECT
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct strbuf held = STRBUF_INIT; // flushed while holding
+static struct strbuf packed = STRBUF_INIT; // out of the compressor
+static bool holding;
+static bool hold_bounded;             // by OUTPUT_HOLD_TIME and _SIZE
+static void (*hold_first)(void);      // writes what comes before the held
+static time_t hold_since;
+static int output_fd = STDOUT_FILENO;
+static bool direct;
+
+static void direct_off(void) {
+  int flags = fcntl(output_fd, F_GETFL);
+  if (flags >= 0)
+    fcntl(output_fd, F_SETFL, flags & ~O_DIRECT);
+  direct = false;
+}
+
+/* Write len bytes from the start of a buffer. {{{ */
+static void output_write(struct strbuf *sb, size_t len) {
+  size_t done = 0;
+  if (len == 0)
+    return;
+  while (done < len) {
+    ssize_t r = write(output_fd, sb->buf + done, len - done);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 && errno == EINVAL && direct) {
+      /* unaligned file offset or a file system without O_DIRECT */
+      direct_off();
+      continue;
+    }
+    if (r <= 0) {
+      perror("write");
+      exit(1);
+    }
+    done += r;
+  }
+  memmove(sb->buf, sb->buf + done, sb->len - done);
+  sb->len -= done;
+  sb->buf[sb->len] = '\0';
+} /*}}}*/
+
+static time_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec;
+}
+
+static void release_locked(void);
+
+/* Write out this thread's buffer, with file_lock held. {{{
+ * Compressing, what goes out is what the compressor made of it, the
+ * rest of the stream too at the end. */
+static void flush_locked(bool end) {
+  struct strbuf *sb = &output;
+  if (holding) {
+    strbuf_add(&held, output.buf, output.len);
+    output.len = 0;
+    if (hold_bounded && (held.len > OUTPUT_HOLD_SIZE || now() - hold_since > OUTPUT_HOLD_TIME))
+      release_locked(); // waited long enough
+    return;
+  }
+  uint64_t t = stage_start();
+  if (compress_enabled()) {
+    compress_data(&packed, output.buf, output.len, end);
+    output.len = 0;
+    if (output.buf)
+      output.buf[0] = '\0';
+    sb = &packed;
+  }
+  if (direct) {
+    if (sb->len)
+      strbuf_add(&file, sb->buf, sb->len);
+    sb->len = 0;
+    size_t len = file.len;
+    if (((uintptr_t)file.buf & (OUTPUT_ALIGN - 1)) == 0)
+      len &= ~(size_t)(OUTPUT_ALIGN - 1);
+    else
+      direct_off(); // the buffer had to be moved by realloc()
+    output_write(&file, len);
+  } else {
+    output_write(&file, file.len); // kept from before O_DIRECT was dropped
+    output_write(sb, sb->len);
+  }
+  stage_end(STAGE_OUTPUT, t);
+} /*}}}*/
+
+/* Write out everything, at exit also the part not filling a block. {{{ */
+static void output_flush_all(void) {
+  pthread_mutex_lock(&file_lock);
+  if (direct)
+    direct_off();
+  flush_locked(true);
+  pthread_mutex_unlock(&file_lock);
+  pending = 0;
+} /*}}}*/
+
+/* Write out this thread's buffer. {{{ */
+void output_flush(void) {
+  pthread_mutex_lock(&file_lock);
+  flush_locked(false);
+  pthread_mutex_unlock(&file_lock);
+  pending = 0;
+} /*}}}*/
+
+/* Hold back everything flushed from now on. {{{
+ * The release first writes what first() appends.  Unless bounded, only
+ * output_release() ends the hold. */
+void output_hold(void (*first)(void), bool bounded) {
+  pthread_mutex_lock(&file_lock);
+  holding = true;
+  hold_bounded = bounded;
+  hold_first = first;
+  hold_since = now();
+  pthread_mutex_unlock(&file_lock);
+} /*}}}*/
+
+/* Write what hold_first() appends, then everything held back. {{{
+ * Only the first call does, later ones find nothing held. */
+static void release_locked(void) {
+  if (holding) {
+    strbuf_add(&held, output.buf, output.len); // this thread's, not flushed yet
+    output.len = 0;
+    hold_first();
+    holding = false;
+    flush_locked(false);
+    struct strbuf sb = output; // the held back output goes without a copy
+    output = held;
+    flush_locked(false);
+    held = output;
+    output = sb;
+    strbuf_release(&held);
+    pending = 0;
+  }
+}
+
+void output_release(void) {
+  pthread_mutex_lock(&file_lock);
+  release_locked();
+  pthread_mutex_unlock(&file_lock);
+} /*}}}*/
+
+/* Set up standard output. {{{ */
+void output_init(bool use_direct) {
+  if (use_direct) {
+    void *b;
+    if (posix_memalign(&b, OUTPUT_ALIGN, 2 * OUTPUT_SIZE)) {
+      fprintf(stderr, "Out of memory for output buffer\n");
+      exit(1);
+    }
+    file.buf = b;
+    file.buf[0] = '\0';
+    file.size = 2 * OUTPUT_SIZE;
+  }
+  strbuf_grow(&output, 2 * OUTPUT_SIZE);
+
+  if (use_direct) {
+    /* on a pipe O_DIRECT means packet mode, which readers do not expect */
+    struct stat st;
+    int flags = fcntl(output_fd, F_GETFL);
+    if (fstat(output_fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        flags < 0 || fcntl(output_fd, F_SETFL, flags | O_DIRECT) < 0)
+      fprintf(stderr, "O_DIRECT not supported for output, continuing.\n");
+    else
+      direct = true;
+  }
+  atexit(output_flush_all);
+} /*}}}*/
+
+/* n more programmes are complete, write out the batch if it is full. */
+void output_programmes(int n) {
+  if ((pending += n) >= OUTPUT_BATCH || output.len >= OUTPUT_SIZE)
+    output_flush();
+}
+
+/* NULL comes out as "(null)", like it did with printf. */
+void out_str(const char *s) {
+  if (s == NULL)
+    s = "(null)";
+  strbuf_add(&output, s, strlen(s));
+}
+
+void out_int(int i) {
+  char b[12], *p = b + sizeof(b);
+  unsigned u = i < 0 ? -(unsigned)i : i;
+  do
+    *--p = '0' + u % 10;
+  while (u /= 10);
+  if (i < 0)
+    *--p = '-';
+  strbuf_add(&output, p, b + sizeof(b) - p);
+}
@@ -0,0 +1,230 @@
+/* pipeline.c: decoding EIT sections on worker threads.
+ *
+ * The readers only frame sections and check their CRC, then hand a copy
+ * over to one of the decoder workers, picked by service_id, so the
+ * sections of one service are decoded in order by the same thread and
+ * the event table sees them as it would reading serially.  Each worker
+ * formats the programmes of a section into a buffer of its own and
+ * passes it on to the single writer thread, which puts them back into
+ * the order the sections were read in, per source, before output.
+ *
+ * The stages are connected by single-producer single-consumer rings,
+ * one from every source to every worker and one from every worker to
+ * the writer.  Head and tail are only ever written by one side each.
+ * A consumer waits on a semaphore counting the items in all its rings,
+ * a producer on one counting the free slots of the ring it pushes to;
+ * neither takes a system call unless it has to sleep.
+ *
+ * Jobs the writer holds back for the reordering no longer take a ring
+ * slot, so a reader gets a credit for every section it submits, and the
+ * writer gives it back once that section is written.  With one worker
+ * stalled the others can then not run more than the window ahead. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+#define RING_SIZE 64  // sections in flight per ring, a power of 2
+
+struct job {
+  int source;
+  unsigned seq;           // per source, in reading order
+  int programmes;
+  struct strbuf out;
+  size_t len;
+  uint8_t sec[];
+};
+
+struct ring {
+  struct job *slot[RING_SIZE];
+  unsigned head __attribute__((aligned(64)));  // next to pop, consumer only
+  unsigned tail __attribute__((aligned(64)));  // next to push, producer only
+  sem_t space;
+};
+
+struct worker {
+  pthread_t thread;
+  sem_t items;            // in all rings of in
+  struct ring **in;       // one per source
+  struct ring *out;       // to the writer
+  int next;               // ring of in to look at first
+};
+
+struct reorder {
+  unsigned next;          // seq to write next
+  struct job **window;    // by seq modulo window_size
+  sem_t credits;          // of window_size, sections of the source in flight
+};
+
+static struct worker *workers;
+static int worker_count;
+static int source_count;
+static unsigned *source_seq;
+static pipeline_decode_fn decode;
+
+static pthread_t writer;
+static sem_t writer_items;
+static struct ring **writer_in;  // the out rings of the workers
+static struct reorder *reorder;
+static unsigned window_size;
+
+/* Ring operations. {{{ */
+static struct ring *ring_new(void) {
+  struct ring *r = aligned_alloc(64, sizeof(struct ring));
+  if (r) {
+    memset(r, 0, sizeof(*r));
+    sem_init(&r->space, 0, RING_SIZE);
+  }
+  return r;
+}
+
+static void ring_push(struct ring *r, struct job *j, sem_t *items) {
+  while (sem_wait(&r->space) < 0)
+    ; // EINTR
+  unsigned t = r->tail;
+  r->slot[t & (RING_SIZE - 1)] = j;
+  __atomic_store_n(&r->tail, t + 1, __ATOMIC_RELEASE);
+  sem_post(items);
+}
+
+static struct job *ring_pop(struct ring *r) {
+  unsigned h = r->head;
+  if (h == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  struct job *j = r->slot[h & (RING_SIZE - 1)];
+  __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+  sem_post(&r->space);
+  return j;
+} /*}}}*/
+
+/* Wait for an item in any of n rings, NULL once told to stop. {{{
+ * Every post of items stands for one pushed job, except the last one
+ * from pipeline_stop(), so finding all rings empty after a wait means
+ * everything was taken. */
+static struct job *ring_wait(struct ring **rings, int n, sem_t *items, int *next) {
+  while (sem_wait(items) < 0)
+    ; // EINTR
+  int i;
+  for (i = 0; i < n; i++) {
+    struct job *j = ring_pop(rings[(*next + i) % n]);
+    if (j) {
+      *next = (*next + i + 1) % n;
+      return j;
+    }
+  }
+  return NULL;
+} /*}}}*/
+
+/* Decode the sections of the services assigned to this worker. {{{ */
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  struct job *j;
+  while ((j = ring_wait(w->in, source_count, &w->items, &w->next))) {
+    output = (struct strbuf)STRBUF_INIT;
+    j->programmes = decode(j->sec, j->len);
+    j->out = output;
+    ring_push(w->out, j, &writer_items);
+  }
+  output = (struct strbuf)STRBUF_INIT;
+  return NULL;
+} /*}}}*/
+
+/* Write the decoded sections in reading order. {{{ */
+static void *writer_main(void *arg) {
+  struct job *j;
+  int next = 0;
+  while ((j = ring_wait(writer_in, worker_count, &writer_items, &next))) {
+    struct reorder *o = &reorder[j->source];
+    o->window[j->seq & (window_size - 1)] = j;
+    while ((j = o->window[o->next & (window_size - 1)]) && j->seq == o->next) {
+      o->window[o->next & (window_size - 1)] = NULL;
+      o->next++;
+      if (j->out.len)
+        strbuf_add(&output, j->out.buf, j->out.len);
+      output_programmes(j->programmes);
+      strbuf_release(&j->out);
+      free(j);
+      sem_post(&o->credits);
+    }
+  }
+  output_flush();
+  strbuf_release(&output);
+  return NULL;
+} /*}}}*/
+
+static void *must(void *p) {
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory for decoder pipeline\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* Start the writer and n workers for sources readers. {{{ */
+void pipeline_start(int n, int sources, pipeline_decode_fn fn) {
+  int i, s;
+  worker_count = n;
+  source_count = sources;
+  decode = fn;
+  workers = must(calloc(n, sizeof(*workers)));
+  writer_in = must(calloc(n, sizeof(*writer_in)));
+  source_seq = must(calloc(sources, sizeof(*source_seq)));
+  reorder = must(calloc(sources, sizeof(*reorder)));
+  /* room for the rings and the hands of the workers, the credits keep a
+   * source from having more sections in flight than that */
+  for (window_size = 1; window_size <= n * (2 * RING_SIZE + 1); window_size *= 2)
+    ;
+  for (s = 0; s < sources; s++) {
+    reorder[s].window = must(calloc(window_size, sizeof(struct job *)));
+    sem_init(&reorder[s].credits, 0, window_size);
+  }
+
+  sem_init(&writer_items, 0, 0);
+  for (i = 0; i < n; i++) {
+    struct worker *w = &workers[i];
+    w->in = must(calloc(sources, sizeof(*w->in)));
+    for (s = 0; s < sources; s++)
+      w->in[s] = must(ring_new());
+    w->out = writer_in[i] = must(ring_new());
+    sem_init(&w->items, 0, 0);
+  }
+  bool failed = pthread_create(&writer, NULL, writer_main, NULL) != 0;
+  for (i = 0; i < n && !failed; i++)
+    failed = pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0;
+  if (failed) {
+    fprintf(stderr, "Unable to start decoder threads\n");
+    exit(1);
+  }
+} /*}}}*/
+
+/* Queue a section of source for decoding, checked already. {{{
+ * Only to be called by the one thread reading that source. */
+void pipeline_submit(int source, const void *sec, size_t len) {
+  const struct eit *e = sec;
+  while (sem_wait(&reorder[source].credits) < 0)
+    ; // EINTR
+  struct job *j = must(malloc(sizeof(*j) + len));
+  j->source = source;
+  j->seq = source_seq[source]++;
+  j->len = len;
+  memcpy(j->sec, sec, len);
+  struct worker *w = &workers[HILO(e->service_id) % worker_count];
+  ring_push(w->in[source], j, &w->items);
+} /*}}}*/
+
+/* Decode and write out everything queued, after the readers finished. {{{ */
+void pipeline_stop(void) {
+  int i;
+  for (i = 0; i < worker_count; i++)
+    sem_post(&workers[i].items);
+  for (i = 0; i < worker_count; i++)
+    pthread_join(workers[i].thread, NULL);
+  sem_post(&writer_items);
+  pthread_join(writer, NULL);
+} /*}}}*/
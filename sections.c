@@ -0,0 +1,289 @@
+/* sections.c: EIT sections already received, so carousel repeats can be
+ * dropped before they are checked and decoded again.
+ *
+ * There is one record per (original_network_id, service_id, table_id),
+ * holding the current version_number and a bitmap of the section_numbers
+ * received at that version.  Records live in an open-addressing table
+ * like the one in events.c.
+ *
+ * EIT tables are split into segments of 8 sections, each section naming
+ * the last one used in its segment.  Together with last_section_number
+ * and segment_last_table_id this tells when all announced sections of a
+ * service have arrived, see sections_complete().
+ *
+ * With several demux devices read at once the record is shared, so a
+ * table carried on more than one transport stream is decoded once, and
+ * completion covers all of them.  Every entry point takes the lock.
+ * Completion can also be asked for the services of one transport stream,
+ * the multiplex being read in a sweep over several. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+#define SECTIONS_MIN_SIZE 64
+
+struct section_table {
+  uint16_t onid;
+  uint16_t sid;
+  uint16_t tsid;              // transport_stream_id of the last section
+  uint8_t tid;
+  uint8_t ver;
+  uint8_t last_section;       // last_section_number
+  uint8_t last_table_id;      // segment_last_table_id
+  uint8_t used;
+  uint8_t seen[256 / 8];      // section_numbers received, one byte per segment
+  uint8_t announced[256 / 8]; // section_numbers up to segment_last_section_number
+};
+
+static struct section_table *tables;
+static size_t size, count;
+static unsigned generation;   // bumped whenever a section is marked
+static struct arena memory = ARENA_INIT("section table"); // counted only
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t section_hash(uint16_t onid, uint16_t sid, uint8_t tid) {
+  uint64_t k = ((uint64_t)onid << 24) | ((uint64_t)sid << 8) | tid;
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (size_t)(k >> 32);
+}
+
+static struct section_table *section_find(struct section_table *t, size_t n, uint16_t onid, uint16_t sid, uint8_t tid) {
+  size_t i = section_hash(onid, sid, tid) & (n - 1);
+  while (t[i].used && (t[i].onid != onid || t[i].sid != sid || t[i].tid != tid))
+    i = (i + 1) & (n - 1);
+  return &t[i];
+}
+
+/* Double the table and re-insert all records. {{{ */
+static int section_grow(void) {
+  size_t n = size ? size * 2 : SECTIONS_MIN_SIZE;
+  struct section_table *t = calloc(n, sizeof(struct section_table));
+  if (t == NULL)
+    return -1;
+  size_t i;
+  for (i = 0; i < size; i++)
+    if (tables[i].used)
+      *section_find(t, n, tables[i].onid, tables[i].sid, tables[i].tid) = tables[i];
+  free(tables);
+  tables = t;
+  size = n;
+  arena_count(&memory, count * sizeof(struct section_table), size * sizeof(struct section_table));
+  return 0;
+} /*}}}*/
+
+/* Only EIT sections carry the fields we key on. */
+static inline bool is_eit(const void *sec, size_t len) {
+  int tid = GetTableId(sec);
+  return tid >= 0x4E && tid <= 0x6F && len >= EIT_LEN + 4;
+}
+
+/* Has this section been received at its current version already? {{{
+ * Called before the CRC check, so only trust it for dropping repeats. */
+bool section_seen(const void *sec, size_t len) {
+  if (!is_eit(sec, len))
+    return false;
+  const struct eit *e = sec;
+  bool seen = false;
+  pthread_mutex_lock(&lock);
+  if (size) {
+    struct section_table *t = section_find(tables, size, HILO(e->original_network_id), HILO(e->service_id), e->table_id);
+    seen = t->used && t->ver == e->version_number &&
+        (t->seen[e->section_number / 8] & (1 << (e->section_number % 8)));
+  }
+  pthread_mutex_unlock(&lock);
+  return seen;
+} /*}}}*/
+
+/* Remember a section that passed the CRC check. {{{ */
+void section_mark(const void *sec, size_t len) {
+  if (!is_eit(sec, len))
+    return;
+  pthread_mutex_lock(&lock);
+  if (4 * (count + 1) > 3 * size && section_grow() < 0) {
+    fprintf(stderr, "Out of memory for section table\n");
+    exit(1);
+  }
+
+  const struct eit *e = sec;
+  struct section_table *t = section_find(tables, size, HILO(e->original_network_id), HILO(e->service_id), e->table_id);
+  if (!t->used) {
+    t->onid = HILO(e->original_network_id);
+    t->sid = HILO(e->service_id);
+    t->tid = e->table_id;
+    t->ver = e->version_number;
+    t->used = 1;
+    count++;
+    arena_count(&memory, count * sizeof(struct section_table), size * sizeof(struct section_table));
+  } else if (t->ver != e->version_number) {
+    /* new version: everything received so far is stale */
+    t->ver = e->version_number;
+    memset(t->seen, 0, sizeof(t->seen));
+    memset(t->announced, 0, sizeof(t->announced));
+  }
+
+  t->tsid = HILO(e->transport_stream_id);
+  t->last_section = GetLastSectionNumber(e);
+  t->last_table_id = GetLastTableId(e);
+  /* sections come in segments of 8, each announcing its last used one */
+  int s, first = e->section_number & ~7, last = GetSegmentLastSectionNumber(e);
+  if (last < e->section_number)
+    last = e->section_number;
+  if (last > first + 7)
+    last = first + 7;
+  for (s = first; s <= last; s++)
+    t->announced[s / 8] |= 1 << (s % 8);
+  t->seen[e->section_number / 8] |= 1 << (e->section_number % 8);
+  generation++;
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
+
+/* Is the table in the set of table_ids asked for? */
+static inline bool requested(int tid, const uint8_t *wanted) {
+  return wanted[tid / 8] & (1 << (tid % 8));
+}
+
+/* Count received and announced sections of one table. {{{
+ * A segment is only known once one of its sections arrived, so segments
+ * never heard of count as one missing section. */
+static bool table_progress(const struct section_table *t, int *seen, int *total) {
+  bool done = true;
+  int seg;
+  for (seg = 0; seg <= t->last_section / 8; seg++) {
+    uint8_t a = t->announced[seg], r = t->seen[seg];
+    if (!a) {
+      (*total)++;
+      done = false;
+      continue;
+    }
+    if (a & ~r)
+      done = false;
+    *seen += __builtin_popcount(a & r);
+    *total += __builtin_popcount(a);
+  }
+  return done;
+} /*}}}*/
+
+static inline bool table_known(const struct section_table *t, int tid) {
+  return section_find(tables, size, t->onid, t->sid, tid)->used;
+}
+
+/* Check one table and the schedule tables missing next to it. {{{
+ * The schedule of a service spans the tables from 0x50 (0x60 for other
+ * transport streams) up to its segment_last_table_id; p/f tables stand
+ * alone.  Each gap is accounted to the known table below it, the gap at
+ * the start of the schedule to the lowest known table. */
+static bool service_progress(const struct section_table *t, const uint8_t *wanted, int *seen, int *total) {
+  bool done = table_progress(t, seen, total);
+  if (t->tid < 0x50)
+    return done;
+  int tid, base = t->tid & 0xF0;
+  for (tid = t->tid - 1; tid >= base && !table_known(t, tid); tid--)
+    ;
+  if (tid < base)
+    for (tid = base; tid < t->tid; tid++)
+      if (requested(tid, wanted)) {
+        (*total)++;
+        done = false;
+      }
+  for (tid = t->tid + 1; tid <= t->last_table_id && tid <= (base | 0x0F) && !table_known(t, tid); tid++)
+    if (requested(tid, wanted)) {
+      (*total)++;
+      done = false;
+    }
+  return done;
+} /*}}}*/
+
+/* Have all announced sections of all requested tables been received? {{{
+ * Tables only become known when one of their sections arrives, so this
+ * may be called on a repeated section only: then the carousel wrapped
+ * around at least once and should have shown us every table it has.
+ * With tsid other than -1, only the services of that transport stream
+ * count. */
+bool sections_complete(const uint8_t *wanted, int tsid) {
+  static __thread unsigned checked = -1;  // each reader asks for its own tsid
+  static __thread int checked_tsid;
+  static __thread bool complete;
+  pthread_mutex_lock(&lock);
+  if (checked != generation || checked_tsid != tsid) {
+    checked = generation;
+    checked_tsid = tsid;
+    complete = false;
+
+    size_t i;
+    bool any = false;
+    for (i = 0; i < size; i++) {
+      const struct section_table *t = &tables[i];
+      if (!t->used || !requested(t->tid, wanted) || (tsid >= 0 && t->tsid != tsid))
+        continue;
+      int seen = 0, total = 0;
+      if (!service_progress(t, wanted, &seen, &total))
+        break;
+      any = true;
+    }
+    complete = any && i == size;
+  }
+  bool done = complete;
+  pthread_mutex_unlock(&lock);
+  return done;
+} /*}}}*/
+
+static int compare_tables(const void *a, const void *b) {
+  const struct section_table *x = *(const struct section_table **)a;
+  const struct section_table *y = *(const struct section_table **)b;
+  if (x->onid != y->onid)
+    return x->onid - y->onid;
+  if (x->sid != y->sid)
+    return x->sid - y->sid;
+  return x->tid - y->tid;
+}
+
+/* Count services and complete ones, optionally listing each. {{{ */
+static void count_services(const uint8_t *wanted, int *services, int *complete, FILE *list) {
+  const struct section_table **v = malloc(count * sizeof(*v));
+  size_t i, n = 0;
+  *services = *complete = 0;
+  if (v == NULL)
+    return;
+  for (i = 0; i < size; i++)
+    if (tables[i].used && requested(tables[i].tid, wanted))
+      v[n++] = &tables[i];
+  qsort(v, n, sizeof(*v), compare_tables);
+
+  for (i = 0; i < n; ) {
+    int seen = 0, total = 0;
+    bool done = true;
+    size_t j;
+    for (j = i; j < n && v[j]->onid == v[i]->onid && v[j]->sid == v[i]->sid; j++)
+      done &= service_progress(v[j], wanted, &seen, &total);
+    (*services)++;
+    if (done)
+      (*complete)++;
+    if (list)
+      fprintf(list, " Service %d/%d: %d/%d sections%s\n", v[i]->onid, v[i]->sid,
+          seen, total, done ? ", complete" : "");
+    i = j;
+  }
+  free(v);
+} /*}}}*/
+
+/* Tell how many services are complete, optionally listing each. */
+int sections_services(const uint8_t *wanted, int *complete_count, FILE *list) {
+  static unsigned counted = -1;
+  static int services, complete;
+  pthread_mutex_lock(&lock);
+  if (list || counted != generation) {
+    counted = generation;
+    count_services(wanted, &services, &complete, list);
+  }
+  *complete_count = complete;
+  int n = services;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
@@ -0,0 +1,251 @@
+/* sort.c: programmes by channel and start time, for --sort.
+ *
+ * The rendered programmes are collected instead of written, with the
+ * service_id, the start and stop and their order of arrival, the texts
+ * in an arena.  At the end they come out by service_id and start time,
+ * and where programmes of a service overlap only the one decoded last
+ * is kept, the others being left by versions superseded since.
+ *
+ * Memory is bounded by the budget given to sort_start().  When the
+ * collected programmes reach it, they are sorted and written to a
+ * temporary file as one run, and the arena is reset for the next.  The
+ * runs and what is left in memory are then merged, with a heap over
+ * the next programme of each, so every programme is read back once. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tv_grab_dvb.h"
+
+struct sorted {
+  uint16_t sid;
+  uint16_t onid;
+  uint16_t eid;
+  uint16_t pad;
+  uint32_t len;     // of the text
+  uint32_t pad2;
+  int64_t start, stop;
+  uint64_t seq;     // order of arrival
+};
+
+/* A programme in memory, with its text in the arena. */
+struct entry {
+  struct sorted s;
+  const char *text;
+};
+
+/* A run to be merged, a file or the entries left in memory. */
+struct run {
+  FILE *f;
+  size_t next, count; // of the entries, without a file
+  struct sorted s;    // the current programme
+  struct strbuf text;
+};
+
+static size_t budget;
+static uint64_t seq;
+static struct entry *entries;
+static size_t count, size;
+static struct arena texts = ARENA_INIT("sort buffer");
+static struct arena table = ARENA_INIT("sort table");
+static FILE **files;
+static int file_count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void sort_start(size_t bytes) {
+  budget = bytes;
+}
+
+static int compare_sorted(const struct sorted *x, const struct sorted *y) {
+  if (x->sid != y->sid)
+    return x->sid - y->sid;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  return compare_sorted(&((const struct entry *)a)->s, &((const struct entry *)b)->s);
+}
+
+/* Write the programmes in memory to a temporary file, sorted. {{{ */
+static void spill(void) {
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  size_t i;
+  snprintf(path, sizeof(path), "%s/epgrab-sort-XXXXXX", dir && *dir ? dir : "/tmp");
+  int fd = mkstemp(path);
+  FILE *f = fd < 0 ? NULL : fdopen(fd, "w+");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  unlink(path); // gone once closed
+  qsort(entries, count, sizeof(*entries), compare_entries);
+  for (i = 0; i < count; i++)
+    if (fwrite(&entries[i].s, sizeof(entries[i].s), 1, f) != 1 ||
+        fwrite(entries[i].text, 1, entries[i].s.len, f) != entries[i].s.len) {
+      perror(path);
+      exit(1);
+    }
+  if (fflush(f) != 0) {
+    perror(path);
+    exit(1);
+  }
+  FILE **v = realloc(files, (file_count + 1) * sizeof(*v));
+  if (v == NULL) {
+    fprintf(stderr, "Out of memory for sort runs\n");
+    exit(1);
+  }
+  files = v;
+  files[file_count++] = f;
+  count = 0;
+  arena_reset(&texts);
+  arena_count(&table, 0, size * sizeof(*entries));
+} /*}}}*/
+
+/* Collect a rendered programme. {{{ */
+void sort_programme(int onid, int sid, int eid, time_t start, time_t stop, const char *text, size_t len) {
+  pthread_mutex_lock(&lock);
+  if (count == size) {
+    size_t n = size ? size * 2 : 1024;
+    struct entry *v = realloc(entries, n * sizeof(*v));
+    if (v == NULL) {
+      fprintf(stderr, "Out of memory for sort table\n");
+      exit(1);
+    }
+    entries = v;
+    size = n;
+  }
+  struct entry *e = &entries[count++];
+  memset(&e->s, 0, sizeof(e->s));
+  e->s.sid = sid;
+  e->s.onid = onid;
+  e->s.eid = eid;
+  e->s.len = len;
+  e->s.start = start;
+  e->s.stop = stop;
+  e->s.seq = seq++;
+  e->text = arena_copy(&texts, text, len);
+  arena_count(&table, count * sizeof(*entries), size * sizeof(*entries));
+  if (texts.used + count * sizeof(*entries) >= budget)
+    spill();
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
+
+/* Step a run to its next programme, false at its end. {{{ */
+static bool run_next(struct run *r) {
+  r->text.len = 0;
+  if (r->f == NULL) {
+    if (r->next == r->count)
+      return false;
+    r->s = entries[r->next].s;
+    strbuf_add(&r->text, entries[r->next++].text, r->s.len);
+    return true;
+  }
+  if (fread(&r->s, sizeof(r->s), 1, r->f) != 1)
+    return false;
+  strbuf_grow(&r->text, r->s.len);
+  if (fread(r->text.buf, 1, r->s.len, r->f) != r->s.len) {
+    fprintf(stderr, "Sort run cut short\n");
+    exit(1);
+  }
+  r->text.len = r->s.len;
+  r->text.buf[r->text.len] = '\0';
+  return true;
+} /*}}}*/
+
+/* Keep the heap of runs ordered by their current programme. */
+static void heap_down(struct run **heap, int n, int i) {
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= n)
+      return;
+    if (c + 1 < n && compare_sorted(&heap[c + 1]->s, &heap[c]->s) < 0)
+      c++;
+    if (compare_sorted(&heap[c]->s, &heap[i]->s) >= 0)
+      return;
+    struct run *t = heap[i];
+    heap[i] = heap[c];
+    heap[c] = t;
+    i = c;
+  }
+}
+
+static void emit(struct sorted *s, struct strbuf *text) {
+  strbuf_add(&output, text->buf, s->len);
+  output_programmes(1);
+}
+
+/* Merge all runs into the output, dropping overlapped programmes. {{{
+ * Returns the number of programmes written. */
+int sort_output(void) {
+  int i, n = 0, written = 0;
+  struct run *runs = calloc(file_count + 1, sizeof(*runs));
+  struct run **heap = calloc(file_count + 1, sizeof(*heap));
+  struct sorted kept;       // waiting for the next one of its service
+  struct strbuf kept_text = STRBUF_INIT;
+  bool have = false;
+
+  if (runs == NULL || heap == NULL) {
+    fprintf(stderr, "Out of memory for sort runs\n");
+    exit(1);
+  }
+  pthread_mutex_lock(&lock);
+  qsort(entries, count, sizeof(*entries), compare_entries);
+  for (i = 0; i <= file_count; i++) {
+    struct run *r = &runs[i];
+    if (i < file_count) {
+      r->f = files[i];
+      rewind(r->f);
+    } else
+      r->count = count;
+    if (run_next(r))
+      heap[n++] = r;
+  }
+  for (i = n / 2 - 1; i >= 0; i--)
+    heap_down(heap, n, i);
+
+  while (n > 0) {
+    struct run *r = heap[0];
+    bool overlaps = have && kept.sid == r->s.sid && r->s.start < kept.stop;
+    if (!overlaps || r->s.seq > kept.seq) {
+      /* overlapping, the later one is the current version */
+      if (have && !overlaps) {
+        emit(&kept, &kept_text);
+        written++;
+      }
+      kept = r->s;
+      struct strbuf t = kept_text; // swapped, the run reuses the buffer
+      kept_text = r->text;
+      r->text = t;
+      have = true;
+    }
+    if (!run_next(r))
+      heap[0] = heap[--n];
+    heap_down(heap, n, 0);
+  }
+  if (have) {
+    emit(&kept, &kept_text);
+    written++;
+  }
+
+  for (i = 0; i <= file_count; i++) {
+    if (runs[i].f)
+      fclose(runs[i].f);
+    strbuf_release(&runs[i].text);
+  }
+  strbuf_release(&kept_text);
+  free(runs);
+  free(heap);
+  free(files);
+  files = NULL;
+  file_count = count = 0;
+  arena_reset(&texts);
+  pthread_mutex_unlock(&lock);
+  return written;
+} /*}}}*/
@@ -0,0 +1,312 @@
+/* stats.c: counters and where the time goes, for --stats and the daemon.
+ *
+ * Every thread counts into a struct metrics of its own, allocated on its
+ * first count and kept on a list, so counting is a plain add without a
+ * lock or an atomic read-modify-write.  Readers walk the list and add up
+ * what the threads have, which is only done for the status line, at most
+ * every STATUS_EVERY, and when the counters are asked for.  The counts of
+ * threads that ended stay where they are.
+ *
+ * Besides the counters of enum metric, the sections are counted by
+ * table_id, and the stages of handling a section are timed where they
+ * run: the CRC check, parseEIT() with the writer, the text conversion of
+ * xmlify() within it, and the output, writing and compressing.  The
+ * times go into a histogram for each stage, with buckets doubling from
+ * 1 us up.  Unless stats_start() was called, stage_start() returns 0 and
+ * nothing reads the clock.
+ *
+ * stats_report() puts out the totals with the rates of sections and
+ * programmes over the wall time since stats_start(), one line for the
+ * counts and one for the stages, for bench/run.sh to pick up.
+ * metrics_write() puts out everything, memory_usage() too, as Prometheus
+ * text or as JSON. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tv_grab_dvb.h"
+
+#define BUCKET_MIN 10   // the first bucket has times below 2^10 ns
+#define BUCKETS    22   // 2^10 to 2^30 ns, about 1 s, and those above
+
+static const char *const stage_names[STAGES] = {
+  [STAGE_CRC] = "crc",
+  [STAGE_DECODE] = "parseEIT",
+  [STAGE_TEXT] = "xmlify",
+  [STAGE_OUTPUT] = "output",
+};
+
+static const struct {
+  const char *name, *help;
+} metric_info[METRICS] = {
+  [METRIC_PROGRAMMES] = { "programmes", "Programmes written." },
+  [METRIC_UPDATES] = { "updates", "New versions of events written before." },
+  [METRIC_INVALID_DATES] = { "invalid_dates", "Programmes over or too far ahead." },
+  [METRIC_REPEATS] = { "repeats", "Sections received before, carousel repeats." },
+  [METRIC_CRC_ERRORS] = { "crc_errors", "Sections failing their CRC check." },
+  [METRIC_OVERFLOWS] = { "overflows", "Demux buffer overflows." },
+  [METRIC_TS_DISCONTINUITIES] = { "ts_discontinuities", "Transport stream packets lost." },
+  [METRIC_TEXT] = { "texts", "Strings converted to UTF-8." },
+  [METRIC_ICONV] = { "iconv", "Strings of them converted by iconv()." },
+  [METRIC_ICONV_FAILED] = { "iconv_failed", "Conversions iconv() failed." },
+};
+
+struct histogram {
+  uint64_t bucket[BUCKETS];
+  uint64_t sum;       // ns
+};
+
+struct metrics {
+  uint64_t counter[METRICS];
+  uint64_t sections[256]; // by table_id
+  struct histogram stage[STAGES];
+  struct metrics *next;
+};
+
+static __thread struct metrics *mine;
+static struct metrics *all;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool enabled;
+static uint64_t started;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* This thread's counters, registered on first use. {{{ */
+static struct metrics *metrics(void) {
+  if (mine)
+    return mine;
+  mine = calloc(1, sizeof(*mine));
+  if (mine == NULL) {
+    fprintf(stderr, "Out of memory for metrics\n");
+    exit(1);
+  }
+  pthread_mutex_lock(&lock);
+  mine->next = all;
+  all = mine;
+  pthread_mutex_unlock(&lock);
+  return mine;
+} /*}}}*/
+
+/* Only this thread writes them, others may read at any time. */
+static inline void add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t get(const uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void metric_add(enum metric m, int n) {
+  add(&metrics()->counter[m], n);
+}
+
+void metric_section(int table_id) {
+  add(&metrics()->sections[table_id & 0xFF], 1);
+}
+
+/* The sum over all threads. */
+uint64_t metric_total(enum metric m) {
+  struct metrics *t;
+  uint64_t n = 0;
+  pthread_mutex_lock(&lock);
+  for (t = all; t; t = t->next)
+    n += get(&t->counter[m]);
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+uint64_t metric_sections(void) {
+  struct metrics *t;
+  uint64_t n = 0;
+  int i;
+  pthread_mutex_lock(&lock);
+  for (t = all; t; t = t->next)
+    for (i = 0; i < 256; i++)
+      n += get(&t->sections[i]);
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+/* Time stages from now on. */
+void stats_start(void) {
+  enabled = true;
+  started = now_ns();
+}
+
+/* The time a stage starts, 0 when not timing. */
+uint64_t stage_start(void) {
+  return enabled ? now_ns() : 0;
+}
+
+void stage_end(enum stage s, uint64_t start) {
+  if (start == 0)
+    return;
+  uint64_t ns = now_ns() - start;
+  struct histogram *h = &metrics()->stage[s];
+  int b = ns < (1 << BUCKET_MIN) ? 0 : 64 - __builtin_clzll(ns) - BUCKET_MIN;
+  add(&h->bucket[b < BUCKETS ? b : BUCKETS - 1], 1);
+  add(&h->sum, ns);
+}
+
+/* A stage summed over all threads, with the lock held. */
+static void stage_total(enum stage s, struct histogram *h) {
+  struct metrics *t;
+  int b;
+  memset(h, 0, sizeof(*h));
+  for (t = all; t; t = t->next) {
+    for (b = 0; b < BUCKETS; b++)
+      h->bucket[b] += get(&t->stage[s].bucket[b]);
+    h->sum += get(&t->stage[s].sum);
+  }
+}
+
+static uint64_t histogram_count(const struct histogram *h) {
+  uint64_t n = 0;
+  int b;
+  for (b = 0; b < BUCKETS; b++)
+    n += h->bucket[b];
+  return n;
+}
+
+/* Print the counts and rates, and the time of every stage. {{{ */
+void stats_report(FILE *f) {
+  double wall = (now_ns() - started) / 1e9;
+  uint64_t sections = metric_sections(), programmes = metric_total(METRIC_PROGRAMMES);
+  uint64_t repeats = metric_total(METRIC_REPEATS);
+  struct histogram h;
+  int i;
+  if (!enabled)
+    return;
+  if (wall <= 0)
+    wall = 1e-9;
+  fprintf(f, "Stats: %llu sections, %llu programmes in %.3f s: %.0f sections/s, %.0f programmes/s, %.1f%% repeats\n",
+      (unsigned long long)sections, (unsigned long long)programmes, wall, sections / wall, programmes / wall,
+      sections ? 100.0 * repeats / sections : 0.0);
+  fprintf(f, "Stages:");
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < STAGES; i++) {
+    stage_total(i, &h);
+    fprintf(f, "%s %s %.3f ms", i ? "," : "", stage_names[i], h.sum / 1e6);
+  }
+  pthread_mutex_unlock(&lock);
+  fprintf(f, " (xmlify within parseEIT)\n");
+} /*}}}*/
+
+/* Upper bound of a bucket in seconds, +Inf for the last. */
+static void bucket_bound(char *buf, size_t size, int b) {
+  if (b == BUCKETS - 1)
+    snprintf(buf, size, "+Inf");
+  else
+    snprintf(buf, size, "%.9g", (double)(1ULL << (BUCKET_MIN + b)) / 1e9);
+}
+
+/* The samples of a family have to come together, one for each pass. */
+static void prometheus_used(const char *name, size_t used, size_t reserved, void *arg) {
+  strbuf_addf(arg, "epgrab_memory_used_bytes{arena=\"%s\"} %zu\n", name, used);
+}
+
+static void prometheus_reserved(const char *name, size_t used, size_t reserved, void *arg) {
+  strbuf_addf(arg, "epgrab_memory_reserved_bytes{arena=\"%s\"} %zu\n", name, reserved);
+}
+
+static void json_memory(const char *name, size_t used, size_t reserved, void *arg) {
+  struct strbuf *sb = arg;
+  strbuf_addf(sb, "%s\"%s\": {\"used\": %zu, \"reserved\": %zu}",
+      sb->buf[sb->len - 1] == '{' ? "" : ", ", name, used, reserved);
+}
+
+/* Everything counted, in the Prometheus text format. {{{ */
+static void prometheus(struct strbuf *sb, const uint64_t *counter, const uint64_t *sections, const struct histogram *stage) {
+  char le[32];
+  int i, b;
+  strbuf_addf(sb, "# HELP epgrab_sections_total EIT sections received, by table_id.\n"
+      "# TYPE epgrab_sections_total counter\n");
+  for (i = 0; i < 256; i++)
+    if (sections[i])
+      strbuf_addf(sb, "epgrab_sections_total{table_id=\"0x%02x\"} %llu\n", i, (unsigned long long)sections[i]);
+  for (i = 0; i < METRICS; i++)
+    strbuf_addf(sb, "# HELP epgrab_%s_total %s\n# TYPE epgrab_%s_total counter\nepgrab_%s_total %llu\n",
+        metric_info[i].name, metric_info[i].help, metric_info[i].name, metric_info[i].name,
+        (unsigned long long)counter[i]);
+  strbuf_addf(sb, "# HELP epgrab_stage_seconds Time spent in each stage of handling a section.\n"
+      "# TYPE epgrab_stage_seconds histogram\n");
+  for (i = 0; i < STAGES; i++) {
+    uint64_t n = 0;
+    for (b = 0; b < BUCKETS; b++) {
+      n += stage[i].bucket[b];
+      bucket_bound(le, sizeof(le), b);
+      strbuf_addf(sb, "epgrab_stage_seconds_bucket{stage=\"%s\",le=\"%s\"} %llu\n",
+          stage_names[i], le, (unsigned long long)n);
+    }
+    strbuf_addf(sb, "epgrab_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+        "epgrab_stage_seconds_count{stage=\"%s\"} %llu\n",
+        stage_names[i], stage[i].sum / 1e9, stage_names[i], (unsigned long long)n);
+  }
+  strbuf_addf(sb, "# HELP epgrab_memory_used_bytes Bytes in use, by arena or table.\n"
+      "# TYPE epgrab_memory_used_bytes gauge\n");
+  memory_usage(prometheus_used, sb);
+  strbuf_addf(sb, "# HELP epgrab_memory_reserved_bytes Bytes allocated, by arena or table.\n"
+      "# TYPE epgrab_memory_reserved_bytes gauge\n");
+  memory_usage(prometheus_reserved, sb);
+} /*}}}*/
+
+/* The same as one JSON object. {{{ */
+static void json(struct strbuf *sb, const uint64_t *counter, const uint64_t *sections, const struct histogram *stage) {
+  char le[32];
+  const char *sep = "";
+  int i, b;
+  strbuf_addf(sb, "{\"sections\": {");
+  for (i = 0; i < 256; i++)
+    if (sections[i]) {
+      strbuf_addf(sb, "%s\"0x%02x\": %llu", sep, i, (unsigned long long)sections[i]);
+      sep = ", ";
+    }
+  strbuf_addf(sb, "}");
+  for (i = 0; i < METRICS; i++)
+    strbuf_addf(sb, ", \"%s\": %llu", metric_info[i].name, (unsigned long long)counter[i]);
+  strbuf_addf(sb, ", \"stages\": {");
+  for (i = 0; i < STAGES; i++) {
+    strbuf_addf(sb, "%s\"%s\": {\"count\": %llu, \"sum_seconds\": %.9f, \"buckets\": {",
+        i ? ", " : "", stage_names[i], (unsigned long long)histogram_count(&stage[i]), stage[i].sum / 1e9);
+    for (b = 0; b < BUCKETS; b++) {
+      bucket_bound(le, sizeof(le), b);
+      strbuf_addf(sb, "%s\"%s\": %llu", b ? ", " : "", le, (unsigned long long)stage[i].bucket[b]);
+    }
+    strbuf_addf(sb, "}}");
+  }
+  strbuf_addf(sb, "}, \"memory\": {");
+  memory_usage(json_memory, sb);
+  strbuf_addf(sb, "}}\n");
+} /*}}}*/
+
+/* Append all counters to sb, as Prometheus text or JSON. {{{
+ * JSON buckets count the times in them, Prometheus ones those up to
+ * their bound. */
+void metrics_write(struct strbuf *sb, bool as_json) {
+  uint64_t counter[METRICS] = { 0 }, sections[256] = { 0 };
+  struct histogram stage[STAGES];
+  struct metrics *t;
+  int i;
+  pthread_mutex_lock(&lock);
+  for (t = all; t; t = t->next) {
+    for (i = 0; i < METRICS; i++)
+      counter[i] += get(&t->counter[i]);
+    for (i = 0; i < 256; i++)
+      sections[i] += get(&t->sections[i]);
+  }
+  for (i = 0; i < STAGES; i++)
+    stage_total(i, &stage[i]);
+  pthread_mutex_unlock(&lock);
+  if (as_json)
+    json(sb, counter, sections, stage);
+  else
+    prometheus(sb, counter, sections, stage);
+} /*}}}*/
@@ -0,0 +1,56 @@
+/* strbuf.c: growable, NUL-terminated output buffers.
+ *
+ * The text decoders append to a struct strbuf owned by the caller instead
+ * of returning static storage, so any number of them can be in use at the
+ * same time, one per thread if need be. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "tv_grab_dvb.h"
+
+/* Make room for extra more bytes and the terminating NUL. {{{ */
+void strbuf_grow(struct strbuf *sb, size_t extra) {
+  if (sb->len + extra < sb->size)
+    return;
+  size_t n = sb->size ? sb->size : 256;
+  while (n <= sb->len + extra)
+    n *= 2;
+  char *b = realloc(sb->buf, n);
+  if (b == NULL) {
+    fprintf(stderr, "Out of memory for text buffer\n");
+    exit(1);
+  }
+  sb->buf = b;
+  sb->size = n;
+} /*}}}*/
+
+void strbuf_add(struct strbuf *sb, const void *data, size_t len) {
+  strbuf_grow(sb, len);
+  memcpy(sb->buf + sb->len, data, len);
+  sb->len += len;
+  sb->buf[sb->len] = '\0';
+}
+
+void strbuf_addf(struct strbuf *sb, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(sb->buf + sb->len, sb->buf ? sb->size - sb->len : 0, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if (sb->len + n >= sb->size) {
+    strbuf_grow(sb, n);
+    va_start(ap, fmt);
+    vsnprintf(sb->buf + sb->len, sb->size - sb->len, fmt, ap);
+    va_end(ap);
+  }
+  sb->len += n;
+}
+
+void strbuf_release(struct strbuf *sb) {
+  free(sb->buf);
+  sb->buf = NULL;
+  sb->len = sb->size = 0;
+}
@@ -0,0 +1,168 @@
+/* ts.c: sections from a raw MPEG transport stream.
+ *
+ * Captures of the whole multiplex come as 188 byte TS packets (192 with
+ * the M2TS time code in front, 204 with Reed-Solomon parity after).  The
+ * sections of the PIDs asked for with ts_add_pid() are reassembled here:
+ * pointer_field tells where the first new section starts in a packet with
+ * payload_unit_start_indicator set, the continuity_counter tells when a
+ * packet was lost, which drops the section being collected.  Complete
+ * sections are passed to the callback, CRC unchecked.
+ *
+ * The reassembly state belongs to the thread reading the stream, so each
+ * demux device read in parallel has its own. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tv_grab_dvb.h"
+
+#define TS_SYNC 0x47
+#define TS_LEN 188
+#define TS_PIDS 8
+#define SECTION_MAX (3 + 4095)
+
+struct ts_pid {
+  uint16_t pid;
+  int8_t cc;                  // last continuity_counter, -1 if none yet
+  size_t len;                 // bytes collected, 0 if not in a section
+  size_t total;               // section size once the header is in
+  uint8_t buf[SECTION_MAX];
+};
+
+static __thread struct ts_pid pids[TS_PIDS];
+static __thread int npids;
+static __thread uint8_t pid_slot[0x2000];  // index into pids + 1, 0 if not wanted
+
+static __thread int packet_size = TS_LEN;
+static __thread int sync_offset;           // 4 for M2TS
+
+static __thread ts_section_cb section_cb;
+static __thread bool stopped;
+
+/* Reassemble sections on this PID. {{{ */
+void ts_add_pid(int pid) {
+  if (pid_slot[pid & 0x1FFF] || npids == TS_PIDS)
+    return;
+  pids[npids].pid = pid & 0x1FFF;
+  pids[npids].cc = -1;
+  pid_slot[pid & 0x1FFF] = ++npids;
+} /*}}}*/
+
+/* Is this a transport stream?  Look for the sync byte repeating. {{{
+ * Sets up the packet size for ts_feed() and returns it, or 0. */
+int ts_detect(const uint8_t *buf, size_t len) {
+  static const struct { int size, offset; } formats[] = {
+    { 188, 0 }, { 192, 4 }, { 204, 0 },
+  };
+  size_t f;
+  for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    int size = formats[f].size, offset = formats[f].offset, i;
+    for (i = 0; i < 3 && offset + (i + 1) * size <= len; i++)
+      if (buf[offset + i * size] != TS_SYNC)
+        break;
+    if (i >= 2 && (i == 3 || offset + (i + 1) * size > len)) {
+      packet_size = size;
+      sync_offset = offset;
+      return size;
+    }
+  }
+  return 0;
+} /*}}}*/
+
+/* Append to the section being collected, passing it on once complete. {{{
+ * Returns the number of bytes used. */
+static size_t collect(struct ts_pid *s, const uint8_t *p, size_t n) {
+  size_t used = 0;
+  while (n) {
+    size_t want = (s->len < 3 ? 3 : s->total) - s->len;
+    if (want > n)
+      want = n;
+    memcpy(s->buf + s->len, p, want);
+    s->len += want;
+    p += want;
+    n -= want;
+    used += want;
+    if (s->len == 3)
+      s->total = 3 + (((s->buf[1] & 0x0F) << 8) | s->buf[2]);
+    if (s->len >= 3 && s->len == s->total) {
+      s->len = 0;
+      if (section_cb(s->pid, s->buf, s->total))
+        stopped = true;
+      break;
+    }
+  }
+  return used;
+} /*}}}*/
+
+/* Take the payload of one packet. {{{ */
+static void ts_packet(const uint8_t *pkt) {
+  if (pkt[1] & 0x80)          // transport_error_indicator
+    return;
+  int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+  if (!pid_slot[pid])
+    return;
+  struct ts_pid *s = &pids[pid_slot[pid] - 1];
+  bool pusi = pkt[1] & 0x40;
+  int afc = (pkt[3] >> 4) & 3, cc = pkt[3] & 0x0F;
+  const uint8_t *p = pkt + 4, *end = pkt + TS_LEN;
+  bool discontinuity = false;
+
+  if (afc & 2) {              // adaptation_field
+    discontinuity = p[0] && (p[1] & 0x80);
+    p += 1 + p[0];
+  }
+  if (!(afc & 1))             // no payload, counter does not advance
+    return;
+  if (s->cc >= 0 && !discontinuity) {
+    if (cc == s->cc)          // repeated packet
+      return;
+    if (cc != ((s->cc + 1) & 0x0F)) {
+      metric_add(METRIC_TS_DISCONTINUITIES, 1);
+      s->len = 0;
+    }
+  }
+  s->cc = cc;
+  if (p >= end)
+    return;
+
+  if (pusi) {
+    int pointer = *p++;
+    if (p + pointer > end) {
+      s->len = 0;
+      return;
+    }
+    /* the rest of the previous section, if we have its beginning */
+    if (s->len)
+      collect(s, p, pointer);
+    s->len = 0;
+    p += pointer;
+    while (p < end && *p != 0xFF && !stopped) {
+      p += collect(s, p, end - p);
+      if (s->len)             // continues in the next packet
+        break;
+    }
+  } else if (s->len)
+    collect(s, p, end - p);
+} /*}}}*/
+
+/* Feed whole packets to the section reassembly. {{{
+ * Returns the number of bytes used; a partial packet at the end is left
+ * for the next call, as is everything once cb asked to stop. */
+size_t ts_feed(const uint8_t *buf, size_t len, ts_section_cb cb, bool *stop) {
+  size_t k = 0;
+  section_cb = cb;
+  stopped = false;
+  while (k + packet_size <= len && !stopped) {
+    if (buf[k + sync_offset] != TS_SYNC ||
+        (k + 2 * packet_size <= len && buf[k + packet_size + sync_offset] != TS_SYNC)) {
+      k++;                    // lost sync, search for it bytewise
+      continue;
+    }
+    ts_packet(buf + k + sync_offset);
+    k += packet_size;
+  }
+  *stop = stopped;
+  return k;
+} /*}}}*/
@@ -0,0 +1,456 @@
+/* tune.c: tuning the frontend ourselves, and sweeping the multiplexes.
+ *
+ * A dvbv5 channel file (dvbv5-scan, dvbv5-zap) has one entry per
+ * service, a [name] followed by KEY = VALUE lines.  The services of a
+ * multiplex share its delivery parameters, so each FREQUENCY of a
+ * delivery system is kept once, with its parameters as the DTV
+ * properties handed to FE_SET_PROPERTY.
+ *
+ * More multiplexes are learnt from the delivery system descriptors in
+ * the NIT actual of those tuned, see tune_nit(), and appended to the
+ * sweep.  With several adapters each one takes the next multiplex no one
+ * tuned yet; an adapter running out waits while the others may still
+ * find more.
+ *
+ * Satellite frequencies are converted for a universal LNB, as dvbv5-zap
+ * does by default. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+#include <linux/dvb/frontend.h>
+
+#include "si_tables.h"
+#include "tv_grab_dvb.h"
+
+#define MUX_PROPS 16
+#define LOCK_MS   3000  // for FE_HAS_LOCK after tuning
+
+/* Names in the channel file, indexed by the value of the property. */
+static const char *const systems[] = {
+  "UNDEFINED", "DVBC/ANNEX_A", "DVBC/ANNEX_B", "DVBT", "DSS", "DVBS", "DVBS2",
+  "DVBH", "ISDBT", "ISDBS", "ISDBC", "ATSC", "ATSCMH", "DTMB", "CMMB", "DAB",
+  "DVBT2", "TURBO", "DVBC/ANNEX_C", NULL
+};
+static const char *const modulations[] = {
+  "QPSK", "QAM/16", "QAM/32", "QAM/64", "QAM/128", "QAM/256", "QAM/AUTO",
+  "VSB/8", "VSB/16", "PSK/8", "APSK/16", "APSK/32", "DQPSK", "QAM/4_NR", NULL
+};
+static const char *const code_rates[] = {
+  "NONE", "1/2", "2/3", "3/4", "4/5", "5/6", "6/7", "7/8", "8/9", "AUTO",
+  "3/5", "9/10", "2/5", NULL
+};
+static const char *const guard_intervals[] = {
+  "1/32", "1/16", "1/8", "1/4", "AUTO", "1/128", "19/128", "19/256",
+  "PN420", "PN595", "PN945", NULL
+};
+static const char *const transmission_modes[] = {
+  "2K", "8K", "AUTO", "4K", "1K", "16K", "32K", "C1", "C3780", NULL
+};
+static const char *const hierarchies[] = { "NONE", "1", "2", "4", "AUTO", NULL };
+static const char *const inversions[] = { "OFF", "ON", "AUTO", NULL };
+static const char *const rolloffs[] = { "35", "20", "25", "AUTO", NULL };
+static const char *const pilots[] = { "ON", "OFF", "AUTO", NULL };
+static const char *const polarizations[] = { "HORIZONTAL", "VERTICAL", "LEFT", "RIGHT", NULL };
+
+#define KEY_POLARIZATION 0  // not a DTV property, see tune_mux()
+
+static const struct key {
+  const char *name;
+  uint32_t cmd;
+  const char *const *values; // NULL for numbers
+} keys[] = {
+  { "MODULATION", DTV_MODULATION, modulations },
+  { "BANDWIDTH_HZ", DTV_BANDWIDTH_HZ, NULL },
+  { "INVERSION", DTV_INVERSION, inversions },
+  { "SYMBOL_RATE", DTV_SYMBOL_RATE, NULL },
+  { "INNER_FEC", DTV_INNER_FEC, code_rates },
+  { "CODE_RATE_HP", DTV_CODE_RATE_HP, code_rates },
+  { "CODE_RATE_LP", DTV_CODE_RATE_LP, code_rates },
+  { "GUARD_INTERVAL", DTV_GUARD_INTERVAL, guard_intervals },
+  { "TRANSMISSION_MODE", DTV_TRANSMISSION_MODE, transmission_modes },
+  { "HIERARCHY", DTV_HIERARCHY, hierarchies },
+  { "ROLLOFF", DTV_ROLLOFF, rolloffs },
+  { "PILOT", DTV_PILOT, pilots },
+  { "STREAM_ID", DTV_STREAM_ID, NULL },
+  { "POLARIZATION", KEY_POLARIZATION, polarizations },
+};
+
+enum mux_class { MUX_OTHER, MUX_TERRESTRIAL, MUX_CABLE, MUX_SATELLITE };
+
+struct mux {
+  uint32_t system;     // enum fe_delivery_system
+  uint32_t frequency;  // Hz, kHz for satellite, as in the channel file
+  int polarization;    // index into polarizations, -1 if none
+  int nprops;
+  struct dtv_property props[MUX_PROPS];
+};
+
+static struct mux *muxes;
+static int mux_count;
+static int next_mux;     // the next one to tune
+static int done_count;   // tuned and read
+static int active;       // being tuned or read now
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static __thread int current = -1;  // the multiplex this thread reads
+
+static enum mux_class mux_class(uint32_t system) {
+  switch (system) {
+    case SYS_DVBT: case SYS_DVBT2: case SYS_DVBH: case SYS_ISDBT:
+      return MUX_TERRESTRIAL;
+    case SYS_DVBC_ANNEX_A: case SYS_DVBC_ANNEX_B: case SYS_DVBC_ANNEX_C:
+      return MUX_CABLE;
+    case SYS_DVBS: case SYS_DVBS2: case SYS_TURBO:
+      return MUX_SATELLITE;
+  }
+  return MUX_OTHER;
+}
+
+/* Set a property, replacing the value it had. {{{ */
+static void mux_set(struct mux *m, uint32_t cmd, uint32_t data) {
+  int i;
+  for (i = 0; i < m->nprops && m->props[i].cmd != cmd; i++)
+    ;
+  if (i == MUX_PROPS)
+    return;
+  if (i == m->nprops)
+    m->nprops++;
+  m->props[i].cmd = cmd;
+  m->props[i].u.data = data;
+} /*}}}*/
+
+/* The same multiplex, give or take the rounding of its frequency? {{{ */
+static bool same_mux(const struct mux *a, const struct mux *b) {
+  enum mux_class c = mux_class(a->system);
+  uint32_t d = a->frequency > b->frequency ? a->frequency - b->frequency : b->frequency - a->frequency;
+  if (c != mux_class(b->system) || (c == MUX_OTHER && a->system != b->system))
+    return false;
+  if (c == MUX_SATELLITE)
+    return d < 2000 && a->polarization == b->polarization; // kHz
+  return d < 1000000;
+} /*}}}*/
+
+/* Append a multiplex to the sweep, unless it is in already. {{{
+ * Called with the lock held, or before the sweep started. */
+static bool add_mux(const struct mux *m) {
+  int i;
+  if (m->system == SYS_UNDEFINED || m->frequency == 0)
+    return false;
+  for (i = 0; i < mux_count; i++)
+    if (same_mux(&muxes[i], m))
+      return false;
+  struct mux *v = realloc(muxes, (mux_count + 1) * sizeof(*v));
+  if (v == NULL) {
+    fprintf(stderr, "Out of memory for multiplexes\n");
+    exit(1);
+  }
+  muxes = v;
+  muxes[mux_count++] = *m;
+  return true;
+} /*}}}*/
+
+static char *trim(char *s) {
+  char *e = s + strlen(s);
+  while (isspace((unsigned char)*s))
+    s++;
+  while (e > s && isspace((unsigned char)e[-1]))
+    *--e = '\0';
+  return s;
+}
+
+static int value_index(const char *const *values, const char *v) {
+  int i;
+  for (i = 0; values[i]; i++)
+    if (strcmp(values[i], v) == 0)
+      return i;
+  return -1;
+}
+
+/* Take one KEY = VALUE line of an entry. {{{ */
+static void parse_key(struct mux *m, const char *key, const char *value, const char *file) {
+  size_t i;
+  int v;
+  if (strcmp(key, "DELIVERY_SYSTEM") == 0) {
+    if ((v = value_index(systems, value)) < 0) {
+      fprintf(stderr, "%s: Unknown DELIVERY_SYSTEM %s\n", file, value);
+      return;
+    }
+    m->system = v;
+    return;
+  }
+  if (strcmp(key, "FREQUENCY") == 0) {
+    m->frequency = strtoul(value, NULL, 10);
+    return;
+  }
+  for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    if (strcmp(key, keys[i].name) == 0)
+      break;
+  if (i == sizeof(keys) / sizeof(keys[0]))
+    return; // SERVICE_ID, VIDEO_PID and the like, not for tuning
+  if (keys[i].values == NULL) {
+    mux_set(m, keys[i].cmd, strtoul(value, NULL, 10));
+    return;
+  }
+  if ((v = value_index(keys[i].values, value)) < 0) {
+    fprintf(stderr, "%s: Unknown %s %s, left to the frontend\n", file, key, value);
+    return;
+  }
+  if (keys[i].cmd == KEY_POLARIZATION)
+    m->polarization = v;
+  else
+    mux_set(m, keys[i].cmd, v);
+} /*}}}*/
+
+/* Read the multiplexes from a dvbv5 channel file. {{{
+ * Returns how many there are, -1 if the file can't be read. */
+int tune_load(const char *file) {
+  FILE *f = fopen(file, "r");
+  char line[512];
+  struct mux m;
+  bool entry = false;
+
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f)) {
+    char *s = trim(line), *eq;
+    if (*s == '[') {
+      if (entry)
+        add_mux(&m);
+      memset(&m, 0, sizeof(m));
+      m.polarization = -1;
+      entry = true;
+    } else if (entry && *s != '#' && (eq = strchr(s, '='))) {
+      *eq = '\0';
+      parse_key(&m, trim(s), trim(eq + 1), file);
+    }
+  }
+  if (entry)
+    add_mux(&m);
+  fclose(f);
+  return mux_count;
+} /*}}}*/
+
+/* Open the frontend of the adapter a demux device belongs to. {{{ */
+int tune_open(const char *demux) {
+  const char *d = demux ? strstr(demux, "demux") : NULL;
+  char path[256];
+  int fd;
+  if (d == NULL) {
+    fprintf(stderr, "%s: Not a demux device, can't tune\n", demux ? demux : "stdin");
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%.*sfrontend%s", (int)(d - demux), demux, d + 5);
+  if ((fd = open(path, O_RDWR)) < 0)
+    perror(path);
+  return fd;
+} /*}}}*/
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Tune to a multiplex and wait for the lock. {{{ */
+static int tune_mux(int fe, const struct mux *m) {
+  struct dtv_property p[MUX_PROPS + 4];
+  struct dtv_properties cmds = { 0, p };
+  uint32_t frequency = m->frequency;
+  int i;
+
+  if (mux_class(m->system) == MUX_SATELLITE) {
+    /* universal LNB: high band with the 22kHz tone, 18V for horizontal */
+    bool high = frequency >= 11700000;
+    frequency -= high ? 10600000 : 9750000;
+    ioctl(fe, FE_SET_TONE, high ? SEC_TONE_ON : SEC_TONE_OFF);
+    ioctl(fe, FE_SET_VOLTAGE, m->polarization == 0 || m->polarization == 2 ? SEC_VOLTAGE_18 : SEC_VOLTAGE_13);
+  }
+  memset(p, 0, sizeof(p));
+  p[cmds.num++].cmd = DTV_CLEAR;
+  p[cmds.num].cmd = DTV_DELIVERY_SYSTEM;
+  p[cmds.num++].u.data = m->system;
+  p[cmds.num].cmd = DTV_FREQUENCY;
+  p[cmds.num++].u.data = frequency;
+  for (i = 0; i < m->nprops; i++)
+    p[cmds.num++] = m->props[i];
+  p[cmds.num++].cmd = DTV_TUNE;
+  if (ioctl(fe, FE_SET_PROPERTY, &cmds) < 0) {
+    perror("FE_SET_PROPERTY");
+    return -1;
+  }
+
+  int64_t deadline = now_ms() + LOCK_MS;
+  do {
+    fe_status_t status;
+    if (ioctl(fe, FE_READ_STATUS, &status) == 0 && (status & FE_HAS_LOCK))
+      return 0;
+    usleep(20000);
+  } while (now_ms() < deadline);
+  return -1;
+} /*}}}*/
+
+/* Tune to the next multiplex of the sweep. {{{
+ * Returns its index, or -1 once all are done. */
+int tune_next(int fe) {
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (next_mux == mux_count && active > 0)
+      pthread_cond_wait(&changed, &lock); // the others may find more
+    if (next_mux == mux_count)
+      break;
+    int i = next_mux++;
+    struct mux m = muxes[i];
+    active++;
+    pthread_mutex_unlock(&lock);
+    if (tune_mux(fe, &m) == 0) {
+      current = i;
+      return i;
+    }
+    fprintf(stderr, "No lock on %u %s\n", m.frequency, mux_class(m.system) == MUX_SATELLITE ? "kHz" : "Hz");
+    pthread_mutex_lock(&lock);
+    active--;
+    pthread_cond_broadcast(&changed);
+  }
+  pthread_mutex_unlock(&lock);
+  return -1;
+} /*}}}*/
+
+/* Done reading the multiplex tuned last. {{{ */
+void tune_done(void) {
+  pthread_mutex_lock(&lock);
+  active--;
+  done_count++;
+  current = -1;
+  pthread_cond_broadcast(&changed);
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
+
+/* Multiplexes read so far, out of all known. */
+int tune_progress(int *total) {
+  pthread_mutex_lock(&lock);
+  int done = done_count;
+  *total = mux_count;
+  pthread_mutex_unlock(&lock);
+  return done;
+}
+
+static uint32_t bcd(const uint8_t *p, int digits) {
+  uint32_t v = 0;
+  int i;
+  for (i = 0; i < digits; i++)
+    v = v * 10 + ((p[i / 2] >> (i % 2 ? 0 : 4)) & 0x0F);
+  return v;
+}
+
+/* FEC_inner of the cable and satellite descriptors. */
+static const uint8_t fec_inner[16] = {
+  FEC_AUTO, FEC_1_2, FEC_2_3, FEC_3_4, FEC_5_6, FEC_7_8, FEC_8_9, FEC_3_5,
+  FEC_4_5, FEC_9_10, FEC_AUTO, FEC_AUTO, FEC_AUTO, FEC_AUTO, FEC_AUTO, FEC_NONE,
+};
+
+/* Turn a delivery system descriptor into a multiplex. {{{
+ * Returns false for other descriptors and ones for another frontend. */
+static bool delivery(const uint8_t *d, enum mux_class class, struct mux *m) {
+  memset(m, 0, sizeof(*m));
+  m->polarization = -1;
+  if (d[1] < 11)
+    return false;
+  switch (d[0]) {
+    case 0x5A: { // terrestrial_delivery_system_descriptor
+      static const uint8_t constellation[] = { QPSK, QAM_16, QAM_64, QAM_AUTO };
+      static const uint8_t hierarchy[] = { HIERARCHY_NONE, HIERARCHY_1, HIERARCHY_2, HIERARCHY_4 };
+      static const uint8_t code_rate[8] = { FEC_1_2, FEC_2_3, FEC_3_4, FEC_5_6, FEC_7_8, FEC_AUTO, FEC_AUTO, FEC_AUTO };
+      static const uint8_t guard[] = { GUARD_INTERVAL_1_32, GUARD_INTERVAL_1_16, GUARD_INTERVAL_1_8, GUARD_INTERVAL_1_4 };
+      static const uint8_t mode[] = { TRANSMISSION_MODE_2K, TRANSMISSION_MODE_8K, TRANSMISSION_MODE_4K, TRANSMISSION_MODE_AUTO };
+      if (class != MUX_TERRESTRIAL)
+        return false;
+      m->system = SYS_DVBT;
+      m->frequency = (uint32_t)(d[2] << 24 | d[3] << 16 | d[4] << 8 | d[5]) * 10;
+      if (d[6] >> 5 < 4)
+        mux_set(m, DTV_BANDWIDTH_HZ, (8 - (d[6] >> 5)) * 1000000);
+      mux_set(m, DTV_MODULATION, constellation[d[7] >> 6]);
+      mux_set(m, DTV_HIERARCHY, hierarchy[(d[7] >> 3) & 3]);
+      mux_set(m, DTV_CODE_RATE_HP, code_rate[d[7] & 7]);
+      mux_set(m, DTV_CODE_RATE_LP, code_rate[d[8] >> 5]);
+      mux_set(m, DTV_GUARD_INTERVAL, guard[(d[8] >> 3) & 3]);
+      mux_set(m, DTV_TRANSMISSION_MODE, mode[(d[8] >> 1) & 3]);
+      break;
+    }
+    case 0x44: { // cable_delivery_system_descriptor
+      static const uint8_t modulation[8] = { QAM_AUTO, QAM_16, QAM_32, QAM_64, QAM_128, QAM_256, QAM_AUTO, QAM_AUTO };
+      if (class != MUX_CABLE)
+        return false;
+      m->system = SYS_DVBC_ANNEX_A;
+      m->frequency = bcd(d + 2, 8) * 100;
+      mux_set(m, DTV_MODULATION, modulation[d[8] & 7]);
+      mux_set(m, DTV_SYMBOL_RATE, bcd(d + 9, 7) * 100);
+      mux_set(m, DTV_INNER_FEC, fec_inner[d[12] & 0x0F]);
+      break;
+    }
+    case 0x43: { // satellite_delivery_system_descriptor
+      static const uint8_t modulation[] = { QPSK, QPSK, PSK_8, QAM_16 };
+      static const uint8_t rolloff[] = { ROLLOFF_35, ROLLOFF_25, ROLLOFF_20, ROLLOFF_AUTO };
+      bool s2 = d[8] & 0x04;
+      if (class != MUX_SATELLITE)
+        return false;
+      m->system = s2 ? SYS_DVBS2 : SYS_DVBS;
+      m->frequency = bcd(d + 2, 8) * 10;
+      m->polarization = (d[8] >> 5) & 3;
+      mux_set(m, DTV_SYMBOL_RATE, bcd(d + 9, 7) * 100);
+      mux_set(m, DTV_INNER_FEC, fec_inner[d[12] & 0x0F]);
+      if (s2) {
+        mux_set(m, DTV_MODULATION, modulation[d[8] & 3]);
+        mux_set(m, DTV_ROLLOFF, rolloff[(d[8] >> 3) & 3]);
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+  mux_set(m, DTV_INVERSION, INVERSION_AUTO);
+  return true;
+} /*}}}*/
+
+/* Add the multiplexes of a NIT actual section to the sweep. {{{
+ * Only those the frontend tuned now can receive; CRC checked already. */
+void tune_nit(const uint8_t *sec, size_t len) {
+  const struct nit *n = (const struct nit *)sec;
+  size_t pos = NIT_LEN, end;
+  enum mux_class class;
+  bool added = false;
+
+  if (current < 0 || len < NIT_LEN + SIZE_NIT_MID + 4 || n->table_id != 0x40)
+    return;
+  pthread_mutex_lock(&lock);
+  class = mux_class(muxes[current].system);
+  pos += HILO(n->network_descriptor_length);
+  if (pos + SIZE_NIT_MID <= len - 4) {
+    const struct nit_mid *mid = (const struct nit_mid *)(sec + pos);
+    end = pos + SIZE_NIT_MID + HILO(mid->transport_stream_loop_length);
+    if (end > len - 4)
+      end = len - 4;
+    for (pos += SIZE_NIT_MID; pos + NIT_TS_LEN <= end; ) {
+      const struct nit_ts *ts = (const struct nit_ts *)(sec + pos);
+      size_t d = pos + NIT_TS_LEN, d_end = d + HILO(ts->transport_descriptors_length);
+      if (d_end > end)
+        break;
+      for (; d + 2 <= d_end && d + 2 + sec[d + 1] <= d_end; d += 2 + sec[d + 1]) {
+        struct mux m;
+        if (delivery(sec + d, class, &m) && add_mux(&m))
+          added = true;
+      }
+      pos = d_end;
+    }
+  }
+  if (added)
+    pthread_cond_broadcast(&changed);
+  pthread_mutex_unlock(&lock);
+} /*}}}*/
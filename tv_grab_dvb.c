@@ -38,10 +38,10 @@ const char *id = "@(#) $Id: tv_grab_dvb.c 86 2010-10-29 20:27:31Z pmhahn $";
 #include <getopt.h>
 #include <stdarg.h>
 #include <stdint.h>
-#include <signal.h>
 #include <time.h>
 #include <stdbool.h>
-#include <assert.h>
+#include <pthread.h>
+#include <glob.h>
 
 #include <linux/dvb/dmx.h>
 #include "si_tables.h"
@@ -53,38 +53,97 @@ const char *id = "@(#) $Id: tv_grab_dvb.c 86 2010-10-29 20:27:31Z pmhahn $";
 
 static char *ProgName;
 static char *demux = "/dev/dvb/adapter0/demux0";
+#define ADAPTERS "/dev/dvb/adapter*/demux0"
+
+#define STATUS_EVERY 200 // ms between status lines
 
 static int timeout  = 10;
-static int packet_count = 0;
-static int programme_count = 0;
-static int update_count  = 0;
-static int crcerr_count  = 0;
+static int demux_buffer = 1 << 20;
+static __thread bool new_data = false;  // an event not seen before, so wait longer
 static int time_offset   = 0;
-static int invalid_date_count = 0;
 static int chan_filter	     = 0;
 static int chan_filter_mask = 0;
 static bool ignore_bad_dates = true;
 static bool ignore_updates = true;
 static bool use_chanidents = false;
 static bool silent = false;
-
-typedef struct chninfo {
-  struct chninfo *next;
-  int sid;
-  int eid;
-  int ver;
-} chninfo_t;
+static bool exit_when_complete = false;
+static bool direct_output = false;
+static bool ts_input = false;
+static char *cache_file = NULL;
+static bool delta = false;
+static char *tune_file = NULL;  // --tune, sweep the multiplexes in it
+static char *channels_file = NULL; // --channels, names over those of the SDT
+static char *daemon_path = NULL; // --daemon, serve the listing on this socket
+static bool sort_output_order = false; // --sort, by channel and start time
+static int sdt_count;          // devices done with their SDT actual
+static __thread int sweep_tsid = -1;  // of the multiplex swept, once seen
+static const struct writer *writer = &xmltv_writer;
+
+/* A demux device or file, read by a thread of its own if there are more.
+ * A device has an fd for every demux filter, see openInput(). */
+struct device {
+  const char *path;  // NULL for stdin
+  int filters;
+  int *fd;
+  struct input *input; // one for each fd
+  int frontend;        // with --tune
+  int timeout;
+  bool sdt_done;       // has all of its SDT actual, or has none
+  pthread_t thread;
+};
+static struct device *devices;
+static int device_count;
+static __thread int source;  // index of the device this thread reads
+static int decoders = -1;    // threads decoding sections, -1 for one per CPU
+
+/* Sections asked for, each (table_id block, service) a demux filter. */
+struct filter {
+  uint8_t tid, mask;
+};
+static uint8_t tables[256 / 8];  // table_ids, by -n/-m/-p and --tables
+static uint8_t actual[256 / 8];  // those of them for the transport stream tuned
+static bool table_list = false;  // --tables given
+static struct filter filters[256];
+static int filter_count;
+static int *services;            // --services, all if there are none
+static int service_count;
 
 static struct lookup_table *channelid_table;
-static struct chninfo *channels;
+static int channelid_count;
 
 /* Print usage information. {{{ */
 static void usage() {
-  fprintf(stderr, "Usage: %s [-d] [-u] [-c] [-n|m|p] [-s] [-t timeout]\n"
-      "\t[-e encoding] [-o offset] [-i file] [-f file]\n\n"
-      "\t-i file - Read from file/device instead of %s\n"
+  fprintf(stderr, "Usage: %s [-d] [-u] [-c] [-n|m|p] [-s] [-x] [-t timeout] [-B bytes] [-j threads]\n"
+      "\t[-e encoding] [-o offset] [-i file]... [-a] [-f file] [--direct] [--ts]\n"
+      "\t[--cache file [--delta]] [--format xmltv|binary] [--services sid,...]\n"
+      "\t[--tables tid[-tid],...] [--tune file] [--channels file] [--daemon socket]\n"
+      "\t[--sort[=MiB]] [--compress gzip|zstd[:level]] [--stats]\n\n"
+      "\t-i file - Read from file/device instead of %s,\n"
+      "\t     more than one are read in parallel\n"
+      "\t-a - Read from all adapters, " ADAPTERS "\n"
+      "\t--ts - Input is a transport stream (detected for files)\n"
       "\t-f file - Write output to file instead of stdout\n"
+      "\t--direct - Write output with O_DIRECT, bypassing the page cache\n"
+      "\t--cache file - Keep decoded programmes in file for the next run\n"
+      "\t--delta - Only output programmes changed since the --cache file\n"
+      "\t--format binary - Write length-prefixed records instead of XMLTV\n"
       "\t-t timeout - Stop after timeout seconds of no new data\n"
+      "\t-B bytes - Size of the kernel demux buffer, default 1M\n"
+      "\t-j threads - Decode on this many threads, 0 for none, default one per CPU\n"
+      "\t-x - Stop as soon as all announced sections have been received\n"
+      "\t--services sid,... - Only read these services, filtered by the demux\n"
+      "\t--tables tid[-tid],... - Only read these table_ids, filtered by the demux\n"
+      "\t--tune file - Tune to the multiplexes of this dvbv5 channel file in turn,\n"
+      "\t     and to the others the NIT announces\n"
+      "\t--channels file - Channel names instead of those in the SDT, dvbv5 or czap format\n"
+      "\t     (default the --tune file, or " CHANNELS_CONF ")\n"
+      "\t--daemon socket - Read on and serve the listing on this Unix socket,\n"
+      "\t     - for the now/next updates on stdout\n"
+      "\t--sort[=MiB] - Write the programmes by channel and start time at the end,\n"
+      "\t     beyond MiB of memory (default 64) through temporary files\n"
+      "\t--compress gzip|zstd[:level] - Compress the output, flushed every MiB of it\n"
+      "\t--stats - Print sections and programmes per second and the time of each stage\n"
       "\t-o offset  - time offset in hours from -12 to 12\n"
       "\t-c - Use Channel Identifiers from file 'chanidents'\n"
       "\t     (rather than sidnumber.dvb.guide)\n"
@@ -99,33 +158,181 @@ static void usage() {
   _exit(1);
 } /*}}}*/
 
-/* Print progress indicator. {{{ */
-static void status() {
-  if (!silent) {
-    fprintf(stderr, "\r Status: %d pkts, %d prgms, %d updates, %d invalid, %d CRC err",
-        packet_count, programme_count, update_count, invalid_date_count, crcerr_count);
+static void addReserved(const char *name, size_t used, size_t reserved, void *arg) {
+  *(size_t *)arg += reserved;
+}
+
+/* Print progress indicator, at most every STATUS_EVERY ms unless forced. {{{
+ * All counters are added up over the threads, see stats.c. */
+static void status(bool force) {
+  static int64_t next; // ms, of any thread
+  if (silent)
+    return;
+  if (!force) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    int64_t now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000, due = __atomic_load_n(&next, __ATOMIC_RELAXED);
+    if (now < due || !__atomic_compare_exchange_n(&next, &due, now + STATUS_EVERY, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return;
+  }
+  flockfile(stderr); // one line, not pieces from each thread
+  fprintf(stderr, "\r Status: %llu pkts, %llu prgms, %llu updates, %llu invalid, %llu CRC err",
+      (unsigned long long)metric_sections(), (unsigned long long)metric_total(METRIC_PROGRAMMES),
+      (unsigned long long)metric_total(METRIC_UPDATES), (unsigned long long)metric_total(METRIC_INVALID_DATES),
+      (unsigned long long)metric_total(METRIC_CRC_ERRORS));
+  uint64_t n;
+  if ((n = metric_total(METRIC_TS_DISCONTINUITIES)))
+    fprintf(stderr, ", %llu TS discontinuities", (unsigned long long)n);
+  if ((n = metric_total(METRIC_OVERFLOWS)))
+    fprintf(stderr, ", %llu overflows", (unsigned long long)n);
+  if ((n = metric_total(METRIC_ICONV_FAILED)))
+    fprintf(stderr, ", %llu iconv errors", (unsigned long long)n);
+  if (exit_when_complete) {
+    int complete, n = sections_services(tables, &complete, NULL);
+    fprintf(stderr, ", %d/%d services complete", complete, n);
+  }
+  if (tune_file) {
+    int total, done = tune_progress(&total);
+    fprintf(stderr, ", %d/%d multiplexes", done, total);
+  }
+  size_t memory = 0;
+  memory_usage(addReserved, &memory);
+  fprintf(stderr, ", %zu KiB", memory >> 10);
+  funlockfile(stderr);
+} /*}}}*/
+
+/* At exit with --stats. */
+static void printStats(void) {
+  stats_report(stderr);
+}
+
+/* Add a device to read from. {{{ */
+static void add_device(const char *path) {
+  struct device *d = realloc(devices, (device_count + 1) * sizeof(*d));
+  if (d == NULL) {
+    fprintf(stderr, "Out of memory for devices\n");
+    exit(1);
+  }
+  devices = d;
+  d += device_count++;
+  memset(d, 0, sizeof(*d));
+  d->path = path;
+} /*}}}*/
+
+static void addService(int sid, int last) {
+  int *s = realloc(services, (service_count + 1) * sizeof(*s));
+  if (s == NULL) {
+    fprintf(stderr, "Out of memory for services\n");
+    exit(1);
+  }
+  services = s;
+  services[service_count++] = sid;
+}
+
+static void addTables(int first, int last) {
+  int tid;
+  for (tid = first; tid <= last; tid++)
+    tables[tid / 8] |= 1 << (tid % 8);
+  table_list = true;
+}
+
+static inline bool requested(int tid) {
+  return tables[tid / 8] & (1 << (tid % 8));
+}
+
+/* Parse "n,..." or with ranges "n[-m],..." for add(n, m), up to max. {{{ */
+static bool parseList(const char *s, int max, bool ranges, void (*add)(int first, int last)) {
+  char *end;
+  do {
+    long first = strtol(s, &end, 0), last = first;
+    if (end == s)
+      return false;
+    if (ranges && *end == '-') {
+      s = end + 1;
+      last = strtol(s, &end, 0);
+      if (end == s)
+        return false;
+    }
+    if (first < 0 || last < first || last > max)
+      return false;
+    add(first, last);
+    s = end + 1;
+  } while (*end == ',');
+  return *end == '\0';
+} /*}}}*/
+
+/* Cover the table_ids asked for with demux filters. {{{
+ * A filter matches table_id under a mask, so it takes an aligned block of
+ * a power of two of them; -n, -m and -p come out as a single one. */
+static void tableFilters(void) {
+  int tid = 0;
+  while (tid < 256) {
+    int n, i;
+    for (n = 256; n > 1; n /= 2) {
+      for (i = 0; tid % n == 0 && i < n && requested(tid + i); i++)
+        ;
+      if (i == n)
+        break;
+    }
+    if (requested(tid)) {
+      filters[filter_count].tid = tid;
+      filters[filter_count].mask = ~(n - 1);
+      filter_count++;
+    }
+    tid += n;
   }
 } /*}}}*/
 
 /* Parse command line arguments. {{{ */
+enum { OPT_DIRECT = 256, OPT_TS, OPT_CACHE, OPT_DELTA, OPT_FORMAT, OPT_SERVICES, OPT_TABLES, OPT_TUNE, OPT_CHANNELS, OPT_DAEMON, OPT_SORT, OPT_COMPRESS, OPT_STATS }; // long options without a short one
 static int do_options(int arg_count, char **arg_strings) {
   static const struct option Long_Options[] = {
     {"help", 0, 0, 'h'},
     {"timeout", 1, 0, 't'},
+    {"buffer", 1, 0, 'B'},
     {"chanidents", 1, 0, 'c'},
+    {"complete", 0, 0, 'x'},
+    {"all-adapters", 0, 0, 'a'},
+    {"jobs", 1, 0, 'j'},
+    {"direct", 0, 0, OPT_DIRECT},
+    {"ts", 0, 0, OPT_TS},
+    {"cache", 1, 0, OPT_CACHE},
+    {"delta", 0, 0, OPT_DELTA},
+    {"format", 1, 0, OPT_FORMAT},
+    {"services", 1, 0, OPT_SERVICES},
+    {"tables", 1, 0, OPT_TABLES},
+    {"tune", 1, 0, OPT_TUNE},
+    {"channels", 1, 0, OPT_CHANNELS},
+    {"daemon", 1, 0, OPT_DAEMON},
+    {"sort", 2, 0, OPT_SORT},
+    {"compress", 1, 0, OPT_COMPRESS},
+    {"stats", 0, 0, OPT_STATS},
     {0, 0, 0, 0}
   };
   int Option_Index = 0;
   int fd;
+  char *end;
 
   while (1) {
-    int c = getopt_long(arg_count, arg_strings, "udscmpnht:o:f:i:e:", Long_Options, &Option_Index);
+    int c = getopt_long(arg_count, arg_strings, "udscmpnxaht:o:f:i:e:B:j:", Long_Options, &Option_Index);
     if (c == EOF)
       break;
     switch (c) {
       case 'i':
-        demux = strcmp(optarg, "-") ? optarg : NULL;
+        add_device(strcmp(optarg, "-") ? optarg : NULL);
         break;
+      case 'a': {
+        glob_t g;
+        size_t i;
+        if (glob(ADAPTERS, 0, NULL, &g) != 0) {
+          fprintf(stderr, "%s: No DVB adapters found\n", ProgName);
+          usage();
+        }
+        for (i = 0; i < g.gl_pathc; i++)
+          add_device(strdup(g.gl_pathv[i]));
+        globfree(&g);
+        break;
+      }
       case 'f':
         if ((fd = open(optarg, O_CREAT | O_TRUNC | O_WRONLY, 0666)) < 0) {
           fprintf(stderr, "%s: Can't write file %s\n", ProgName, optarg);
@@ -141,6 +348,26 @@ static int do_options(int arg_count, char **arg_strings) {
           usage();
         }
         break;
+      case 'B': {
+        long size = strtol(optarg, &end, 0);
+        if (*end == 'k' || *end == 'K')
+          size <<= 10, end++;
+        else if (*end == 'm' || *end == 'M')
+          size <<= 20, end++;
+        if (*end || size < 4096 || size > (1 << 30)) {
+          fprintf(stderr, "%s: Invalid buffer size\n", ProgName);
+          usage();
+        }
+        demux_buffer = size;
+        break;
+      }
+      case 'j':
+        decoders = strtol(optarg, &end, 10);
+        if (*end || decoders < 0 || decoders > 64) {
+          fprintf(stderr, "%s: Invalid number of decoder threads\n", ProgName);
+          usage();
+        }
+        break;
       case 'o':
         time_offset = atoi(optarg);
         if ((time_offset < -12) || (time_offset > 12)) {
@@ -172,9 +399,75 @@ static int do_options(int arg_count, char **arg_strings) {
       case 's':
         silent = true;
         break;
+      case 'x':
+        exit_when_complete = true;
+        break;
       case 'e':
         iso6937_encoding = optarg;
         break;
+      case OPT_DIRECT:
+        direct_output = true;
+        break;
+      case OPT_TS:
+        ts_input = true;
+        break;
+      case OPT_CACHE:
+        cache_file = optarg;
+        break;
+      case OPT_DELTA:
+        delta = true;
+        break;
+      case OPT_FORMAT:
+        if (strcmp(optarg, "xmltv") == 0)
+          writer = &xmltv_writer;
+        else if (strcmp(optarg, "binary") == 0)
+          writer = &binary_writer;
+        else {
+          fprintf(stderr, "%s: Unknown output format %s\n", ProgName, optarg);
+          usage();
+        }
+        break;
+      case OPT_SERVICES:
+        if (!parseList(optarg, 0xFFFF, false, addService)) {
+          fprintf(stderr, "%s: Invalid service list\n", ProgName);
+          usage();
+        }
+        break;
+      case OPT_TABLES:
+        if (!parseList(optarg, 0xFF, true, addTables)) {
+          fprintf(stderr, "%s: Invalid table_id list\n", ProgName);
+          usage();
+        }
+        break;
+      case OPT_TUNE:
+        tune_file = optarg;
+        break;
+      case OPT_CHANNELS:
+        channels_file = optarg;
+        break;
+      case OPT_DAEMON:
+        daemon_path = optarg;
+        break;
+      case OPT_SORT: {
+        long mib = optarg ? strtol(optarg, &end, 10) : 64;
+        if (optarg && (*end || mib <= 0 || mib > 1 << 20)) {
+          fprintf(stderr, "%s: Invalid --sort budget %s\n", ProgName, optarg);
+          usage();
+        }
+        sort_output_order = true;
+        sort_start((size_t)mib << 20);
+        break;
+      }
+      case OPT_COMPRESS:
+        if (!compress_init(optarg)) {
+          fprintf(stderr, "%s: Unknown or unsupported compression %s\n", ProgName, optarg);
+          usage();
+        }
+        break;
+      case OPT_STATS:
+        stats_start();
+        atexit(printStats); // before output_init(), after the last write
+        break;
       case 'h':
       case '?':
         usage();
@@ -185,15 +478,54 @@ static int do_options(int arg_count, char **arg_strings) {
         _exit(1);
     }
   }
+  /* --tables, or all of them, within what -n/-m/-p leave */
+  int tid;
+  for (tid = 0; tid < 256; tid++) {
+    if (!table_list)
+      tables[tid / 8] |= 1 << (tid % 8);
+    if ((tid & chan_filter_mask) != (chan_filter & chan_filter_mask))
+      tables[tid / 8] &= ~(1 << (tid % 8));
+    if (tid == 0x4E || (tid & 0xF0) == 0x50)
+      actual[tid / 8] |= tables[tid / 8] & (1 << (tid % 8));
+  }
+  tableFilters();
+  if (filter_count == 0) {
+    fprintf(stderr, "%s: No tables left by --tables and -n/-m/-p\n", ProgName);
+    usage();
+  }
+  if (delta && cache_file == NULL) {
+    fprintf(stderr, "%s: --delta needs --cache\n", ProgName);
+    usage();
+  }
+  if (daemon_path && (tune_file || exit_when_complete || cache_file)) {
+    fprintf(stderr, "%s: --daemon reads on, without --tune, -x or --cache\n", ProgName);
+    usage();
+  }
+  if (daemon_path && compress_enabled()) {
+    fprintf(stderr, "%s: --compress is for the output, not with --daemon\n", ProgName);
+    usage();
+  }
+  if (sort_output_order && (daemon_path || delta)) {
+    fprintf(stderr, "%s: --sort writes everything at the end, not with --daemon or --delta\n", ProgName);
+    usage();
+  }
+  if (tune_file && tune_load(tune_file) <= 0) {
+    fprintf(stderr, "%s: No multiplexes in %s\n", ProgName, tune_file);
+    usage();
+  }
+  if (channels_file && channels_load(channels_file) < 0) {
+    fprintf(stderr, "%s: Can't read channel file %s\n", ProgName, channels_file);
+    usage();
+  }
   return 0;
 } /*}}}*/
 
 /* Lookup channel-id. {{{ */
 static char *get_channelident(int chanid) {
-  static char returnstring[256];
+  static __thread char returnstring[256];
 
   if (use_chanidents && channelid_table) {
-    char *c = lookup(channelid_table, chanid);
+    char *c = lookup(channelid_table, channelid_count, chanid);
     if (c)
       return c;
   }
@@ -201,540 +533,469 @@ static char *get_channelident(int chanid) {
   return returnstring;
 } /*}}}*/
 
-/* Parse language-id translation file. {{{ */
-static char *xmllang(u_char *l) {
-  static union lookup_key lang;
-  lang.c[0] = (char)l[0];
-  lang.c[1] = (char)l[1];
-  lang.c[2] = (char)l[2];
-  lang.c[3] = '\0';
+/* Record an event, is it to be output? {{{ */
+static bool wantEvent(struct eit *e, int eid, time_t stop) {
+  switch (event_update(HILO(e->original_network_id), HILO(e->service_id), eid, e->version_number, stop)) {
+    case EVENT_SEEN:
+      return false;
+    case EVENT_UPDATED:
+      metric_add(METRIC_UPDATES, 1); // update outputted version
+      if (ignore_updates)
+        return false;
+      break;
+    case EVENT_NEW: // its a new program
+      break;
+  }
 
-  char *c = lookup(languageid_table, lang.i);
-  return c ? c : lang.c;
+  /* we have more data, refresh timeout */
+  new_data = true;
+  return true;
 } /*}}}*/
 
-/* Parse 0x4D Short Event Descriptor. {{{ */
-enum ER { TITLE, SUB_TITLE };
-static void parseEventDescription(void *data, enum ER round) {
-  assert(GetDescriptorTag(data) == 0x4D);
-  struct descr_short_event *evtdesc = data;
-  char evt[256];
-  char dsc[256];
-
-  int evtlen = evtdesc->event_name_length;
-  if (round == TITLE) {
-    if (!evtlen)
-      return;
-    assert(evtlen < sizeof(evt));
-    memcpy(evt, (char *)&evtdesc->data, evtlen);
-    evt[evtlen] = '\0';
-    printf("\t<title lang=\"%s\">%s</title>\n", xmllang(&evtdesc->lang_code1), xmlify(evt, evtlen));
-    return;
+/* Basic bad date check. {{{
+ * If the program ends before this time yesterday, or two weeks from
+ * today, forget it.  Only events to be output are counted. */
+static bool validDate(time_t stop_time, time_t now, bool wanted) {
+  if ((stop_time - now < -24*60*60) || (now - stop_time > 14*24*60*60) ) {
+    if (wanted)
+      metric_add(METRIC_INVALID_DATES, 1);
+    return !ignore_bad_dates;
   }
+  return true;
+} /*}}}*/
 
-  if (round == SUB_TITLE) {
-    int dsclen = evtdesc->data[evtlen];
-    assert(dsclen < sizeof(dsc));
-    memcpy(dsc, (char *)&evtdesc->data[evtlen+1], dsclen);
-    dsc[dsclen] = '\0';
-
-    if (*dsc) {
-      char *d = xmlify(dsc, dsclen);
-      if (d && *d)
-        printf("\t<sub-title lang=\"%s\">%s</sub-title>\n", xmllang(&evtdesc->lang_code1), d);
+/* Output the programmes of a section decoded by an earlier run. {{{
+ * For --delta, they are unchanged since then, so only record them. */
+static int replayEIT(struct eit *e, const struct cache_event *ce, int n, const char *text, time_t now) {
+  int programmes = 0;
+  for (; n > 0; n--, ce++) {
+    if (!wantEvent(e, ce->eid, ce->stop) || ce->kind == CACHE_EMPTY || delta)
+      continue;
+    if (!validDate(ce->stop, now, true) || ce->kind != CACHE_PROGRAMME)
+      continue;
+    metric_add(METRIC_PROGRAMMES, 1);
+    if (sort_output_order)
+      sort_programme(HILO(e->original_network_id), HILO(e->service_id), ce->eid, ce->start, ce->stop, text + ce->text, ce->len);
+    else {
+      strbuf_add(&output, text + ce->text, ce->len);
+      programmes++;
     }
   }
+  return programmes;
 } /*}}}*/
 
-/* Parse 0x4E Extended Event Descriptor. {{{ */
-void parseLongEventDescription(void *data) {
-  assert(GetDescriptorTag(data) == 0x4E);
-  struct descr_extended_event *levt = data;
-  char dsc[256];
-  bool non_empty = (levt->descriptor_number || levt->last_descriptor_number || levt->length_of_items || levt->data[0]);
-
-  if (non_empty && levt->descriptor_number == 0)
-    printf("\t<desc lang=\"%s\">", xmllang(&levt->lang_code1));
-
-  void *p = &levt->data;
-  void *data_end = data + DESCR_GEN_LEN + GetDescriptorLength(data);
-  while (p < (void *)levt->data + levt->length_of_items) {
-    struct item_extended_event *name = p;
-    int name_len = name->item_description_length;
-    assert(p + ITEM_EXTENDED_EVENT_LEN + name_len < data_end);
-    assert(name_len < sizeof(dsc));
-    memcpy(dsc, (char *)&name->data, name_len);
-    dsc[name_len] = '\0';
-    printf("%s: ", xmlify(dsc, name_len));
-
-    p += ITEM_EXTENDED_EVENT_LEN + name_len;
-
-    struct item_extended_event *value = p;
-    int value_len = value->item_description_length;
-    assert(p + ITEM_EXTENDED_EVENT_LEN + value_len < data_end);
-    assert(value_len < sizeof(dsc));
-    memcpy(dsc, (char *)&value->data, value_len);
-    dsc[value_len] = '\0';
-    printf("%s; ", xmlify(dsc, value_len));
-
-    p += ITEM_EXTENDED_EVENT_LEN + value_len;
-  }
-  struct item_extended_event *text = p;
-  int len = text->item_description_length;
-  if (non_empty && len) {
-    assert(len < sizeof(dsc));
-    memcpy(dsc, (char *)&text->data, len);
-    dsc[len] = '\0';
-    printf("%s", xmlify(dsc, len));
-  }
-
-  //printf("/%d/%d/%s", levt->descriptor_number, levt->last_descriptor_number, xmlify(dsc));
-  if (non_empty && levt->descriptor_number == levt->last_descriptor_number)
-    printf("</desc>\n");
-} /*}}}*/
+static void outRemoved(const char *text, size_t len) {
+  writer->removed(&output, text, len);
+}
 
-/* Parse 0x50 Component Descriptor.  {{{
-   video is a flag, 1=> output the video information, 0=> output the
-   audio information.  seen is a pointer to a counter to ensure we
-   only output the first one of each (XMLTV can't cope with more than
-   one) */
-enum CR { LANGUAGE, VIDEO, AUDIO, SUBTITLES };
-static void parseComponentDescription(void *data, enum CR round, int *seen) {
-  assert(GetDescriptorTag(data) == 0x50);
-  struct descr_component *dc = data;
-  char buf[256];
-
-  int len = dc->descriptor_length;
-  assert(len < sizeof(buf));
-  memcpy(buf, (char *)&dc->data, len);
-  buf[len] = '\0';
-
-  switch (dc->stream_content) {
-    case 0x01: // Video Info
-      if (round == VIDEO && !*seen) {
-        //if ((dc->component_type-1)&0x08) //HD TV
-        //if ((dc->component_type-1)&0x04) //30Hz else 25
-        printf("\t<video>\n");
-        printf("\t\t<aspect>%s</aspect>\n", lookup(aspect_table, (dc->component_type-1) & 0x03));
-        printf("\t</video>\n");
-        (*seen)++;
-      }
-      break;
-    case 0x02: // Audio Info
-      if (round == AUDIO && !*seen) {
-        printf("\t<audio>\n");
-        printf("\t\t<stereo>%s</stereo>\n", lookup(audio_table, (dc->component_type)));
-        printf("\t</audio>\n");
-        (*seen)++;
-      }
-      if (round == LANGUAGE) {
-        if (!*seen)
-          printf("\t<language>%s</language>\n", xmllang(&dc->lang_code1));
-        else
-          printf("\t<!--language>%s</language-->\n", xmllang(&dc->lang_code1));
-        (*seen)++;
-      }
-      break;
-    case 0x03: // Teletext Info
-      if (round == SUBTITLES) {
-        // FIXME: is there a suitable XMLTV output for this?
-        // if ((dc->component_type)&0x10) //subtitles
-        // if ((dc->component_type)&0x20) //subtitles for hard of hearing
-        printf("\t<subtitles type=\"teletext\">\n");
-        printf("\t\t<language>%s</language>\n", xmllang(&dc->lang_code1));
-        printf("\t</subtitles>\n");
-      }
-      break;
-      // case 0x04: // AC3 info
-  }
-#if 0
-  printf("\t<StreamComponent>\n");
-  printf("\t\t<StreamContent>%d</StreamContent>\n", dc->stream_content);
-  printf("\t\t<ComponentType>%x</ComponentType>\n", dc->component_type);
-  printf("\t\t<ComponentTag>%x</ComponentTag>\n", dc->component_tag);
-  printf("\t\t<Length>%d</Length>\n", dc->component_tag, dc->descriptor_length-6);
-  printf("\t\t<Language>%s</Language>\n", lang);
-  printf("\t\t<Data>%s</Data>\n", buf);
-  printf("\t</StreamComponent>\n");
-#endif
+/* Compare a programme rendered at mark with the one in the cache. {{{
+ * Returns false for one that did not change, for an update inserts the
+ * removal of the old one before, so the new one may start elsewhere. */
+static bool deltaProgramme(struct eit *e, struct eit_event *evt, size_t mark) {
+  const char *old;
+  size_t len = output.len - mark;
+  size_t old_len = cache_programme(HILO(e->original_network_id), HILO(e->service_id), HILO(evt->event_id), &old);
+  if (old_len == 0)
+    return true; // added
+  if (old_len == len && memcmp(old, output.buf + mark, len) == 0)
+    return false;
+  struct strbuf removal = STRBUF_INIT;
+  writer->removed(&removal, old, old_len);
+  strbuf_grow(&output, removal.len);
+  memmove(output.buf + mark + removal.len, output.buf + mark, len + 1);
+  memcpy(output.buf + mark, removal.buf, removal.len);
+  output.len += removal.len;
+  strbuf_release(&removal);
+  return true;
 } /*}}}*/
 
-static inline void set_bit(int *bf, int b) {
-  int i = b / 8 / sizeof(int);
-  int s = b % (8 * sizeof(int));
-  bf[i] |= (1 << s);
-}
+/* Parse Event Information Table. {{{
+ * Returns the number of programmes added to the output.  With a cache,
+ * sections it has are taken from there, and the others have all their
+ * events rendered for it, even those not output this time. */
+static int parseEIT(void *data, size_t len) {
+  static __thread struct cache_event cached[4096 / EIT_EVENT_LEN];
+  static __thread struct strbuf cached_text = STRBUF_INIT;
+  static __thread struct programme prog;
+  struct eit *e = data;
+  void *p;
+  time_t now;
+  int programmes = 0, n = 0;
+  const char *text;
+
+  time(&now);
+  const struct cache_event *ce = cache_file ? cache_lookup(data, len, &n, &text) : NULL;
+  if (ce)
+    return replayEIT(e, ce, n, text, now);
+  cached_text.len = 0;
+  len -= 4; //remove CRC
 
-static inline bool get_bit(int *bf, int b) {
-  int i = b / 8 / sizeof(int);
-  int s = b % (8 * sizeof(int));
-  return bf[i] & (1 << s);
-}
+  // For each event listing
+  for (p = &e->data; p < data + len; p += EIT_EVENT_LEN + GetEITDescriptorsLoopLength(p)) {
+    struct eit_event *evt = p;
+    time_t start_time = (time_t)(HILO(evt->mjd) - 40587) * 24*60*60 + BcdTimeToSeconds(evt->start_time) + time_offset * 3600;
+    time_t stop_time = start_time + BcdTimeToSeconds(evt->duration);
+    /* the daemon keeps the latest rendering of every programme, but only
+     * counts those that would be output */
+    bool fresh = wantEvent(e, HILO(evt->event_id), stop_time);
+    bool wanted = fresh || daemon_path;
+    if (!wanted && !cache_file)
+      continue;
+
+    struct cache_event *c = &cached[n++];
+    memset(c, 0, sizeof(*c));
+    c->eid = HILO(evt->event_id);
+    c->start = start_time;
+    c->stop = stop_time;
+    c->kind = CACHE_EMPTY;
 
-/* Parse 0x54 Content Descriptor. {{{ */
-static void parseContentDescription(void *data) {
-  assert(GetDescriptorTag(data) == 0x54);
-  struct descr_content *dc = data;
-  int once[256/8/sizeof(int)] = {0,};
-  void *p;
-  for (p = &dc->data; p < data + dc->descriptor_length; p += NIBBLE_CONTENT_LEN) {
-    struct nibble_content *nc = p;
-    int c1 = (nc->content_nibble_level_1 << 4) + nc->content_nibble_level_2;
-#ifdef CATEGORY_UNKNOWN
-    int c2 = (nc->user_nibble_1 << 4) + nc->user_nibble_2;
-#endif
-    if (c1 > 0 && !get_bit(once, c1)) {
-      set_bit(once, c1);
-      char *c = lookup(description_table, c1);
-      if (c)
-        if (c[0])
-          printf("\t<category>%s</category>\n", c);
-#ifdef CATEGORY_UNKNOWN
-        else
-          printf("\t<!--category>%s %02X %02X</category-->\n", c+1, c1, c2);
-      else
-        printf("\t<!--category>%02X %02X</category-->\n", c1, c2);
-#endif
-    }
-    // This is weird in the uk, they use user but not content, and almost the same values
-  }
-} /*}}}*/
+    // No program info at end! Just skip it
+    if (GetEITDescriptorsLoopLength(evt) == 0)
+      continue;
 
-/* Parse 0x55 Rating Descriptor. {{{ */
-void parseRatingDescription(void *data) {
-  assert(GetDescriptorTag(data) == 0x55);
-  struct descr_parental_rating *pr = data;
-  void *p;
-  for (p = &pr->data; p < data + pr->descriptor_length; p += PARENTAL_RATING_ITEM_LEN) {
-    struct parental_rating_item *pr = p;
-    switch (pr->rating) {
-      case 0x00: /*undefined*/
-        break;
-      case 0x01 ... 0x0F:
-        printf("\t<rating system=\"dvb\">\n");
-        printf("\t\t<value>%d</value>\n", pr->rating + 3);
-        printf("\t</rating>\n");
-        break;
-      case 0x10 ... 0xFF: /*broadcaster defined*/
-        break;
+    c->kind = CACHE_DATED;
+    if (!validDate(stop_time, now, fresh))
+      continue;
+
+    // a program must have a title that isn't empty
+    c->kind = CACHE_UNTITLED;
+    if (eit_describe(&prog, &evt->data, GetEITDescriptorsLoopLength(evt)) <= 0)
+      continue;
+
+    prog.channel = get_channelident(HILO(e->service_id));
+    prog.onid = HILO(e->original_network_id);
+    prog.tsid = HILO(e->transport_stream_id);
+    prog.sid = HILO(e->service_id);
+    prog.eid = HILO(evt->event_id);
+    prog.running_status = evt->running_status;
+    prog.start = start_time;
+    prog.stop = stop_time;
+    size_t mark = output.len;
+    writer->programme(&prog);
+
+    if (daemon_path) {
+      daemon_programme(&prog, e->table_id < 0x50, output.buf + mark, output.len - mark);
+      output.len = mark; // kept by the daemon instead
+      output.buf[mark] = '\0';
+      if (fresh)
+        metric_add(METRIC_PROGRAMMES, 1);
+      continue;
+    }
+    if (cache_file) {
+      c->kind = CACHE_PROGRAMME;
+      c->text = cached_text.len;
+      c->len = output.len - mark;
+      strbuf_add(&cached_text, output.buf + mark, c->len);
+    }
+    if (!wanted || (delta && !deltaProgramme(e, evt, mark))) {
+      output.len = mark; // only rendered for the cache
+      output.buf[mark] = '\0';
+      continue;
     }
+    metric_add(METRIC_PROGRAMMES, 1);
+    if (sort_output_order) {
+      sort_programme(prog.onid, prog.sid, prog.eid, start_time, stop_time, output.buf + mark, output.len - mark);
+      output.len = mark; // comes out in order at the end
+      output.buf[mark] = '\0';
+    } else
+      programmes++;
   }
+  if (cache_file)
+    cache_store(data, len + 4, cached, n, cached_text.buf, cached_text.len);
+  return programmes;
 } /*}}}*/
 
-/* Parse 0x5F Private Data Specifier. {{{ */
-int parsePrivateDataSpecifier(void *data) {
-  assert(GetDescriptorTag(data) == 0x5F);
-  return GetPrivateDataSpecifier(data);
-} /*}}}*/
-
-/* Parse 0x76 Content Identifier Descriptor. {{{ */
-/* See ETSI TS 102 323, section 12 */
-void parseContentIdentifierDescription(void *data) {
-  assert(GetDescriptorTag(data) == 0x76);
-  struct descr_content_identifier *ci = data;
-  void *p;
-  for (p = &ci->data; p < data + ci->descriptor_length; /* at end */) {
-    struct descr_content_identifier_crid *crid = p;
-    struct descr_content_identifier_crid_local *crid_data;
-
-    int crid_length = 3;
+/* Is the service one asked for by --services? {{{ */
+static bool wantedSid(int sid) {
+  int i;
+  for (i = 0; i < service_count; i++)
+    if (services[i] == sid)
+      return true;
+  return service_count == 0;
+}
 
-    char type_buf[32];
-    char *type;
-    char buf[256];
+static bool wantedService(const void *sec, size_t len) {
+  if (service_count == 0 || len < EIT_LEN)
+    return service_count == 0;
+  return wantedSid(HILO(((const struct eit *)sec)->service_id));
+} /*}}}*/
 
-    type = lookup(crid_type_table, crid->crid_type);
-    if (type == NULL)
-    {
-      type = type_buf;
-      sprintf(type_buf, "0x%2x", crid->crid_type);
-    }
+/* The channel list, ahead of the programmes held back for it. {{{ */
+static void writeChannel(int sid, const char *name, int len) {
+  if (wantedSid(sid))
+    writer->channel(sid, get_channelident(sid), name, len);
+}
 
-    switch (crid->crid_location)
-    {
-      case 0x00: /* Carried explicitly within descriptor */
-        crid_data = (descr_content_identifier_crid_local_t *)&crid->crid_ref_data;
-        int cridlen = crid_data->crid_length;
-        assert(cridlen < sizeof(buf));
-        memcpy(buf, (char *)&crid_data->crid_byte, cridlen);
-        buf[cridlen] = '\0';
+static void writeChannels(void) {
+  channels_list(writeChannel);
+} /*}}}*/
 
-        printf("\t<crid type='%s'>%s</crid>\n", type, xmlify(buf, cridlen));
-        crid_length = 2 + crid_data->crid_length;
-        break;
-      case 0x01: /* Carried in Content Identifier Table (CIT) */
-        break;
-      default:
-        break;
+/* Exit hook: close xml tags. {{{ */
+static void finish_up() {
+  if (!silent) {
+    status(true);
+    fprintf(stderr, "\n");
+    if (exit_when_complete) {
+      int complete;
+      sections_services(tables, &complete, stderr);
     }
-
-    p += crid_length;
   }
+  output_release();
+  if (sort_output_order)
+    sort_output();
+  if (delta)
+    cache_removed(time(NULL), outRemoved);
+  writer->tail();
+  if (cache_file)
+    cache_write();
+  exit(0);
 } /*}}}*/
 
-/* Parse Descriptor. {{{
- * Tags should be output in this order:
+/* Is there nothing left to wait for? {{{
+ * Sweeping, the multiplex is done once the schedule of its own transport
+ * stream is; otherwise only -x stops, once everything is in. */
+static bool complete(void) {
+  if (tune_file)
+    return sweep_tsid >= 0 && sections_complete(actual, sweep_tsid);
+  return exit_when_complete && sections_complete(tables, -1);
+} /*}}}*/
 
- 'title', 'sub-title', 'desc', 'credits', 'date', 'category', 'language',
- 'orig-language', 'length', 'icon', 'url', 'country', 'episode-num',
- 'video', 'audio', 'previously-shown', 'premiere', 'last-chance',
- 'new', 'subtitles', 'rating', 'star-rating'
- */
-static void parseDescription(void *data, size_t len) {
-  int round, pds = 0;
-
-  for (round = 0; round < 8; round++) {
-    int seen = 0; // no title/language/video/audio/subtitles seen in this round
-    void *p;
-    for (p = data; p < data + len; p += DESCR_GEN_LEN + GetDescriptorLength(p)) {
-      struct descr_gen *desc = p;
-      switch (GetDescriptorTag(desc)) {
-        case 0:
-          break;
-        case 0x4D: //short evt desc, [title] [sub-title]
-          // there can be multiple language versions of these
-          if (round == 0) {
-            parseEventDescription(desc, TITLE);
-          }
-          else if (round == 1)
-            parseEventDescription(desc, SUB_TITLE);
-          break;
-        case 0x4E: //long evt descriptor [desc]
-          if (round == 2)
-            parseLongEventDescription(desc);
-          break;
-        case 0x50: //component desc [language] [video] [audio] [subtitles]
-          if (round == 4)
-            parseComponentDescription(desc, LANGUAGE, &seen);
-          else if (round == 5)
-            parseComponentDescription(desc, VIDEO, &seen);
-          else if (round == 6)
-            parseComponentDescription(desc, AUDIO, &seen);
-          else if (round == 7)
-            parseComponentDescription(desc, SUBTITLES, &seen);
-          break;
-        case 0x53: // CA Identifier Descriptor
-          break;
-        case 0x54: // content desc [category]
-          if (round == 3)
-            parseContentDescription(desc);
-          break;
-        case 0x55: // Parental Rating Descriptor [rating]
-          if (round == 7)
-            parseRatingDescription(desc);
-          break;
-        case 0x5f: // Private Data Specifier
-          pds = parsePrivateDataSpecifier(desc);
-          break;
-        case 0x64: // Data broadcast desc - Text Desc for Data components
-          break;
-        case 0x69: // Programm Identification Label
-          break;
-        case 0x81: // TODO ???
-          if (pds == 5) // ARD_ZDF_ORF
-            break;
-        case 0x82: // VPS (ARD, ZDF, ORF)
-          if (pds == 5) // ARD_ZDF_ORF
-            // TODO: <programme @vps-start="???">
-            break;
-        case 0x4F: // Time Shifted Event
-        case 0x52: // Stream Identifier Descriptor
-        case 0x5E: // Multi Lingual Component Descriptor
-        case 0x83: // Logical Channel Descriptor (some kind of news-ticker on ARD-MHP-Data?)
-        case 0x84: // Preferred Name List Descriptor
-        case 0x85: // Preferred Name Identifier Descriptor
-        case 0x86: // Eacem Stream Identifier Descriptor
-          break;
-        case 0x76: // Content identifier descriptor
-          if (round == 5)
-            parseContentIdentifierDescription(desc);
-          break;
-        default:
-          if (round == 0)
-            printf("\t<!--Unknown_Please_Report ID=\"%x\" Len=\"%d\" -->\n", GetDescriptorTag(desc), GetDescriptorLength(desc));
-      }
-    }
-  }
+/* The CRC check and parseEIT(), timed for --stats. {{{ */
+static bool checkCRC(void *sec, size_t len) {
+  uint64_t t = stage_start();
+  bool ok = _dvb_crc32((uint8_t *)sec, len) == 0;
+  stage_end(STAGE_CRC, t);
+  return ok;
+}
+
+static int decodeEIT(void *sec, size_t len) {
+  uint64_t t = stage_start();
+  int n = parseEIT(sec, len);
+  stage_end(STAGE_DECODE, t);
+  return n;
 } /*}}}*/
 
-/* Check that program has at least a title as is required by xmltv.dtd. {{{ */
-static bool validateDescription(void *data, size_t len) {
-  void *p;
-  for (p = data; p < data + len; p += DESCR_GEN_LEN + GetDescriptorLength(p)) {
-    struct descr_gen *desc = p;
-    if (GetDescriptorTag(desc) == 0x4D) {
-      struct descr_short_event *evtdesc = p;
-      // make sure that title isn't empty
-      if (evtdesc->event_name_length) return true;
+/* Check and decode one complete section. {{{
+ * Returns true once all announced sections are in and -x asked to stop,
+ * or the multiplex swept is complete. */
+static bool handleSection(void *sec, size_t l) {
+  metric_section(GetTableId(sec));
+  if (section_seen(sec, l)) {
+    /* carousel repeat of a section we already have */
+    metric_add(METRIC_REPEATS, 1);
+    if (complete()) {
+      status(true);
+      return true;
     }
+  } else if (!checkCRC(sec, l)) {
+    /* data or length is wrong. skip bytewise. */
+    //l = 1; // FIXME
+    metric_add(METRIC_CRC_ERRORS, 1);
+  } else {
+    int tid = GetTableId(sec);
+    if (tune_file && sweep_tsid < 0 && l >= EIT_LEN && (actual[tid / 8] & (1 << (tid % 8))))
+      sweep_tsid = HILO(((struct eit *)sec)->transport_stream_id);
+    section_mark(sec, l);
+    if (decoders) {
+      new_data = true; // a new section, which is as close as we can tell
+      pipeline_submit(source, sec, l);
+    } else
+      output_programmes(decodeEIT(sec, l));
   }
+  status(false);
   return false;
 } /*}}}*/
 
-/* Use the routine specified in ETSI EN 300 468 V1.4.1, {{{
- * "Specification for Service Information in Digital Video Broadcasting"
- * to convert from Modified Julian Date to Year, Month, Day. */
-static void parseMJD(long int mjd, struct tm *t) {
-  int year = (int) ((mjd - 15078.2) / 365.25);
-  int month = (int) ((mjd - 14956.1 - (int) (year * 365.25)) / 30.6001);
-  int day = mjd - 14956 - (int) (year * 365.25) - (int) (month * 30.6001);
-  int i = (month == 14 || month == 15) ? 1 : 0;
-  year += i ;
-  month = month - 2 - i * 12;
-
-  t->tm_mday = day;
-  t->tm_mon = month;
-  t->tm_year = year;
-  t->tm_isdst = -1;
-  t->tm_wday = t->tm_yday = 0;
+/* A device has all of its SDT actual, or won't get any. {{{
+ * Once every device is, the channels are written, followed by the
+ * programmes held back for them.  Sweeping, later multiplexes bring
+ * more, so that waits until the end. */
+static void sdtDone(struct device *d) {
+  if (d->sdt_done || tune_file || daemon_path)
+    return;
+  d->sdt_done = true;
+  if (__atomic_add_fetch(&sdt_count, 1, __ATOMIC_RELAXED) == device_count)
+    output_release();
 } /*}}}*/
 
-/* Parse Event Information Table. {{{ */
-static void parseEIT(void *data, size_t len) {
-  struct eit *e = data;
-  void *p;
-  struct tm  dvb_time;
-  char       date_strbuf[256];
-
-  len -= 4; //remove CRC
-
-  // For each event listing
-  for (p = &e->data; p < data + len; p += EIT_EVENT_LEN + GetEITDescriptorsLoopLength(p)) {
-    struct eit_event *evt = p;
-    struct chninfo *c;
-    // find existing information?
-    for (c = channels; c != NULL; c = c->next) {
-      // found it
-      if (c->sid == HILO(e->service_id) && (c->eid == HILO(evt->event_id))) {
-        if (c->ver <= e->version_number) // seen it before or its older FIXME: wrap-around to 0
-          return;
-        else {
-          c->ver = e->version_number; // update outputted version
-          update_count++;
-          if (ignore_updates)
-            return;
-          break;
-        }
-      }
-    }
+/* Service names for the channel list, from an SDT section. {{{ */
+static void handleSDT(const uint8_t *sec, size_t len) {
+  if (_dvb_crc32(sec, len) != 0)
+    return;
+  if (channels_sdt(source, sec, len))
+    sdtDone(&devices[source]);
+} /*}}}*/
 
-    // its a new program
-    if (c == NULL) {
-      chninfo_t *nc = malloc(sizeof(struct chninfo));
-      nc->sid = HILO(e->service_id);
-      nc->eid = HILO(evt->event_id);
-      nc->ver = e->version_number;
-      nc->next = channels;
-      channels = nc;
-    }
+/* Sections reassembled from a transport stream. {{{
+ * The demux filters are not there to pick the sections, so do it here. */
+static bool handleTsSection(int pid, const uint8_t *sec, size_t len) {
+  int tid = GetTableId(sec);
+  if (pid == 0x11) {
+    if (tid == 0x42 || tid == 0x46)
+      handleSDT(sec, len);
+    return false;
+  }
+  if (pid != 0x12 || tid < 0x4E || tid > 0x6F || !requested(tid) ||
+      !wantedService(sec, len))
+    return false;
+  return handleSection((void *)sec, len);
+} /*}}}*/
 
-    /* we have more data, refresh alarm */
-    if (timeout) alarm(timeout);
+/* Is there an SDT among the sections of a capture? {{{
+ * Only those read so far, all of them if the file is mapped. */
+static bool hasSDT(const uint8_t *buf, size_t len) {
+  size_t pos = 0;
+  while (len - pos >= sizeof(struct si_tab) && GetTableId(buf + pos) != 0) {
+    int tid = GetTableId(buf + pos);
+    if (tid == 0x42 || tid == 0x46)
+      return true;
+    size_t l = sizeof(struct si_tab) + GetSectionLength(buf + pos);
+    if (len - pos < l)
+      break; // the rest is still to come
+    pos += l;
+  }
+  return false;
+} /*}}}*/
 
-    // No program info at end! Just skip it
-    if (GetEITDescriptorsLoopLength(evt) == 0)
+/* Read EIT segments from DVB-demuxer or file. {{{ */
+static void readEventTables(struct device *d) {
+  struct input *in = &d->input[0];
+  bool ts = false, stop = false;
+  int i, k = 0;
+
+  source = d - devices;
+  for (i = 0; i < d->filters; i++)
+    if (input_open(&d->input[i], d->fd[i], d->filters > 1 ? (1 << 20) / d->filters : 0) < 0) {
+      fprintf(stderr, "Out of memory for input buffer\n");
       return;
-
-    parseMJD(HILO(evt->mjd), &dvb_time);
-
-    dvb_time.tm_sec =  BcdCharToInt(evt->start_time_s);
-    dvb_time.tm_min =  BcdCharToInt(evt->start_time_m);
-    dvb_time.tm_hour = BcdCharToInt(evt->start_time_h) + time_offset;
-    time_t start_time = timegm(&dvb_time);
-
-    dvb_time.tm_sec  += BcdCharToInt(evt->duration_s);
-    dvb_time.tm_min  += BcdCharToInt(evt->duration_m);
-    dvb_time.tm_hour += BcdCharToInt(evt->duration_h);
-    time_t stop_time = timegm(&dvb_time);
-
-    time_t now;
-    time(&now);
-    // basic bad date check. if the program ends before this time yesterday, or two weeks from today, forget it.
-    if ((difftime(stop_time, now) < -24*60*60) || (difftime(now, stop_time) > 14*24*60*60) ) {
-      invalid_date_count++;
-      if (ignore_bad_dates)
-        return;
     }
+  input_timeout(in, d->timeout);
+  if (!in->mapped)
+    input_poll(d->input, d->filters, &k);
+  /* captures of the whole multiplex need their sections reassembled */
+  if (ts_input || ts_detect(in->buf, in->len)) {
+    ts = true;
+    ts_add_pid(0x12); // EIT
+    ts_add_pid(0x11); // SDT
+  }
+  /* a demux device has a filter for the SDT, nothing to wait for in
+   * a capture of sections without one */
+  if (!ts && d->filters == 1 && !hasSDT(in->buf + in->pos, in->len - in->pos))
+    sdtDone(d);
 
-    // a program must have a title that isn't empty
-    if (!validateDescription(&evt->data, GetEITDescriptorsLoopLength(evt))) {
-      return;
+  /* The dvb demultiplexer simply outputs individual whole packets (good),
+   * but reading captured data from a file needs re-chunking. (bad).
+   * With several filters, k is the one that was read last. */
+  do {
+    in = &d->input[k];
+    if (ts)
+      in->pos += ts_feed(in->buf + in->pos, in->len - in->pos, handleTsSection, &stop);
+    else while (!stop && in->len - in->pos >= sizeof(struct si_tab)) {
+      struct si_tab *tab = (struct si_tab *)(in->buf + in->pos);
+      if (GetTableId(tab) == 0) {
+        stop = true; // not a section, nothing after it is used either
+        break;
+      }
+      size_t l = sizeof(struct si_tab) + GetSectionLength(tab);
+      if (in->len - in->pos < l)
+        break;
+      int tid = GetTableId(tab);
+      if (tid == 0x40) { // NIT actual, only asked for sweeping
+        if (_dvb_crc32((uint8_t *)tab, l) == 0)
+          tune_nit((uint8_t *)tab, l);
+      } else if (tid == 0x42 || tid == 0x46) {
+        handleSDT((uint8_t *)tab, l);
+      } else if (!requested(tid) || !wantedService(tab, l)) {
+        /* not asked for by --tables or --services, like in handleTsSection() */
+      } else if (handleSection(tab, l)) {
+        stop = true;
+        break;
+      }
+      in->pos += l;
     }
-
-    programme_count++;
-
-    printf("<programme channel=\"%s\" ", get_channelident(HILO(e->service_id)));
-    strftime(date_strbuf, sizeof(date_strbuf), "start=\"%Y%m%d%H%M%S %z\"", localtime(&start_time) );
-    printf("%s ", date_strbuf);
-    strftime(date_strbuf, sizeof(date_strbuf), "stop=\"%Y%m%d%H%M%S %z\"", localtime(&stop_time));
-    printf("%s>\n ", date_strbuf);
-
-    //printf("\t<EventID>%i</EventID>\n", HILO(evt->event_id));
-    //printf("\t<RunningStatus>%i</RunningStatus>\n", evt->running_status);
-    //1 Airing, 2 Starts in a few seconds, 3 Pausing, 4 About to air
-
-    parseDescription(&evt->data, GetEITDescriptorsLoopLength(evt));
-    printf("</programme>\n");
+    if (new_data) {
+      input_timeout(&d->input[0], d->timeout);
+      new_data = false;
+    }
+  } while (!stop && input_poll(d->input, d->filters, &k) > 0);
+  sdtDone(d); // the SDT won't come any more
+  for (i = 0; i < d->filters; i++) {
+    input_close(&d->input[i]);
+    if (d->path)
+      close(d->fd[i]);
   }
 } /*}}}*/
 
-/* Exit hook: close xml tags. {{{ */
-static void finish_up() {
-  if (!silent)
-    fprintf(stderr, "\n");
-  printf("</tv>\n");
-  exit(0);
+/* Give a device n fds, kept for the next multiplex of a sweep. {{{ */
+static void setFilters(struct device *d, int n) {
+  if (d->fd && d->filters == n)
+    return;
+  free(d->fd);
+  free(d->input);
+  d->filters = n;
+  d->fd = calloc(n, sizeof(*d->fd));
+  d->input = calloc(n, sizeof(*d->input));
+  if (d->fd == NULL || d->input == NULL) {
+    fprintf(stderr, "Out of memory for devices\n");
+    exit(1);
+  }
 } /*}}}*/
 
-/* Read EIT segments from DVB-demuxer or file. {{{ */
-static void readEventTables(void) {
-  int r, n = 0;
-  char buf[1<<12], *bhead = buf;
+/* Set up a section filter for one block of tables and a service. {{{
+ * sid is -1 for all services.  The filter bytes skip the section_length,
+ * so the service_id, bytes 3 and 4 of the section, are 1 and 2 here. */
+static int setFilter(int fd, int pid, const struct filter *f, int sid, int buffer) {
+  struct dmx_sct_filter_params sctFilterParams = {
+    .pid = pid, // 18 for EIT data
+    .timeout = 0,
+    .flags =  DMX_IMMEDIATE_START,
+    .filter = {
+      .filter[0] = f->tid, // 4e is now/next this multiplex, 4f others
+      .mask[0] = f->mask,
+    },
+  };
+  if (sid >= 0) {
+    sctFilterParams.filter.filter[1] = sid >> 8;
+    sctFilterParams.filter.filter[2] = sid & 0xFF;
+    sctFilterParams.filter.mask[1] = 0xFF;
+    sctFilterParams.filter.mask[2] = 0xFF;
+  }
 
-  /* The dvb demultiplexer simply outputs individual whole packets (good),
-   * but reading captured data from a file needs re-chunking. (bad). */
-  do {
-    if (n < sizeof(struct si_tab))
-      goto read_more;
-    struct si_tab *tab = (struct si_tab *)bhead;
-    if (GetTableId(tab) == 0)
-      goto read_more;
-    size_t l = sizeof(struct si_tab) + GetSectionLength(tab);
-    if (n < l)
-      goto read_more;
-    packet_count++;
-    if (_dvb_crc32((uint8_t *)bhead, l) != 0) {
-      /* data or length is wrong. skip bytewise. */
-      //l = 1; // FIXME
-      crcerr_count++;
-    } else
-      parseEIT(bhead, l);
-    status();
-    /* remove packet */
-    n -= l;
-    bhead += l;
-    continue;
-read_more:
-    /* move remaining data to front of buffer */
-    if (n > 0)
-      memmove(buf, bhead, n);
-    /* fill with fresh data */
-    r = read(STDIN_FILENO, buf+n, sizeof(buf)-n);
-    bhead = buf;
-    n += r;
-  } while (r > 0);
+  /* dense EIT schedules overrun the small default buffer */
+  if (ioctl(fd, DMX_SET_BUFFER_SIZE, (unsigned long)buffer) < 0)
+    perror("DMX_SET_BUFFER_SIZE");
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  if (ioctl(fd, DMX_SET_FILTER, &sctFilterParams) < 0) {
+    perror("DMX_SET_FILTER:");
+    return -1;
+  }
+  return 0;
 } /*}}}*/
 
-/* Setup demuxer or open file as STDIN. {{{ */
-static int openInput(void) {
+static void closeFilters(struct device *d, int n) {
+  while (n-- > 0)
+    close(d->fd[n]);
+}
+
+/* Setup demuxer or open file, or use STDIN. {{{
+ * A demux device gets a section filter for every block of tables times
+ * every service asked for, each on an fd of its own, sharing -B.  After
+ * them come one for the SDT and, sweeping, one for the NIT. */
+static int openInput(struct device *d) {
   int fd_epg, to;
   struct stat stat_buf;
 
-  if (demux == NULL)
-    return 0; // Read from STDIN, which is open al
+  d->timeout = timeout;
+  if (d->path == NULL) {
+    setFilters(d, 1);
+    d->fd[0] = STDIN_FILENO; // which is open already
+    d->timeout = 0;
+    return 0;
+  }
 
-  if ((fd_epg = open(demux, O_RDWR)) < 0) {
-    perror("fd_epg DEVICE: ");
+  if ((fd_epg = open(d->path, O_RDWR)) < 0) {
+    perror(d->path);
     return -1;
   }
 
@@ -743,94 +1004,107 @@ static int openInput(void) {
     return -1;
   }
   if (S_ISCHR(stat_buf.st_mode)) {
+    static const struct filter sdt = { 0x42, 0xFB }, nit = { 0x40, 0xFF }; // SDT 0x42 and 0x46
+    int i, eit = filter_count * (service_count ? service_count : 1);
+    int n = eit + 1 + (tune_file != NULL);
+    int buffer = demux_buffer / n < 65536 ? 65536 : demux_buffer / n;
     bool found = false;
-    struct dmx_sct_filter_params sctFilterParams = {
-      .pid = 18, // EIT data
-      .timeout = 0,
-      .flags =  DMX_IMMEDIATE_START,
-      .filter = {
-        .filter[0] = chan_filter, // 4e is now/next this multiplex, 4f others
-        .mask[0] = chan_filter_mask,
-      },
-    };
-
-    if (ioctl(fd_epg, DMX_SET_FILTER, &sctFilterParams) < 0) {
-      perror("DMX_SET_FILTER:");
-      close(fd_epg);
-      return -1;
+
+    setFilters(d, n);
+    d->fd[0] = fd_epg;
+    for (i = 0; i < n; i++) {
+      if (i > 0 && (d->fd[i] = open(d->path, O_RDWR)) < 0) {
+        perror(d->path);
+        closeFilters(d, i);
+        return -1;
+      }
+      int r = i < eit ? setFilter(d->fd[i], 0x12, &filters[i % filter_count], service_count ? services[i / filter_count] : -1, buffer) :
+          i == eit ? setFilter(d->fd[i], 0x11, &sdt, -1, buffer) : setFilter(d->fd[i], 0x10, &nit, -1, buffer);
+      if (r < 0) {
+        closeFilters(d, i + 1);
+        return -1;
+      }
     }
 
-    for (to = timeout; to > 0; to--) {
+    for (to = d->timeout; to > 0; to--) {
       int res;
-      struct pollfd ufd = {
-        .fd = fd_epg,
-        .events = POLLIN,
-      };
+      struct pollfd ufd[n];
+      for (i = 0; i < n; i++) {
+        ufd[i].fd = d->fd[i];
+        ufd[i].events = POLLIN;
+      }
 
-      res = poll(&ufd, 1, 1000);
+      res = poll(ufd, n, 1000);
       if (0 == res) {
         fprintf(stderr, ".");
         fflush(stderr);
         continue;
       }
-      if (1 == res) {
+      if (res > 0) {
         found = true;
         break;
       }
       fprintf(stderr, "error polling for data\n");
-      close(fd_epg);
+      closeFilters(d, n);
       return -1;
     }
-    fprintf(stdout, "\n");
     if (!found) {
-      fprintf(stderr, "timeout - try tuning to a multiplex?\n");
-      close(fd_epg);
+      fprintf(stderr, "%s: timeout - try tuning to a multiplex?\n", d->path);
+      closeFilters(d, n);
       return -1;
     }
-
-    signal(SIGALRM, finish_up);
-    alarm(timeout);
   } else {
-    // disable alarm timeout for normal files
-    timeout = 0;
+    // disable timeout for normal files
+    d->timeout = 0;
+    setFilters(d, 1);
+    d->fd[0] = fd_epg;
   }
-
-  dup2(fd_epg, STDIN_FILENO);
-  close(fd_epg);
-
   return 0;
 } /*}}}*/
 
-/* Read [cst]zap channels.conf file and print as XMLTV channel info. {{{ */
-static void readZapInfo() {
-  FILE *fd_zap;
-  char buf[256];
-  if ((fd_zap = fopen(CHANNELS_CONF, "r")) == NULL) {
-    fprintf(stderr, "No [cst]zap channels.conf to produce channel info\n");
-    return;
+/* Read the multiplexes of the sweep in turn, as they get tuned. {{{ */
+static void sweepDevice(struct device *d) {
+  while (tune_next(d->frontend) >= 0) {
+    sweep_tsid = -1;
+    if (openInput(d) == 0)
+      readEventTables(d);
+    tune_done();
+    status(true);
   }
+  close(d->frontend);
+} /*}}}*/
 
-  /* name:freq:inversion:symbol_rate:fec:quant:vid:aid:chanid:... */
-  while (fgets(buf, sizeof(buf), fd_zap)) {
-    int i = 0;
-    char *c, *id = NULL;
-    for (c = buf; *c; c++)
-      if (*c == ':') {
-        *c = '\0';
-        if (++i == 8) /* chanid */
-          id = c + 1;
-      }
-    if (id && *id) {
-      int chanid = atoi(id);
-      if (chanid) { 
-        printf("<channel id=\"%s\">\n", get_channelident(chanid));
-        printf("\t<display-name>%s</display-name>\n", xmlify(buf, sizeof(c)));
-        printf("</channel>\n");
-      }
+/* Read one of several devices, merging into the common output. {{{ */
+static void *readerThread(void *arg) {
+  if (tune_file)
+    sweepDevice(arg);
+  else
+    readEventTables(arg);
+  output_flush();
+  strbuf_release(&output);
+  return NULL;
+} /*}}}*/
+
+/* Open the cache, for programmes rendered the same way. {{{
+ * The fingerprint covers the output format and all options changing the
+ * output of an event, besides TZ, which the XMLTV times are shown in. */
+static void openCache(void) {
+  const char *tz = getenv("TZ");
+  bool binary = writer == &binary_writer;
+  uint32_t fp = cache_hash(0, &time_offset, sizeof(time_offset));
+  fp = cache_hash(fp, &binary, sizeof(binary));
+  fp = cache_hash(fp, &ignore_bad_dates, sizeof(ignore_bad_dates));
+  fp = cache_hash(fp, iso6937_encoding, strlen(iso6937_encoding) + 1);
+  if (tz)
+    fp = cache_hash(fp, tz, strlen(tz) + 1);
+  if (use_chanidents && channelid_table) {
+    int i;
+    for (i = 0; i < channelid_count; i++) {
+      fp = cache_hash(fp, &channelid_table[i].u.i, sizeof(channelid_table[i].u.i));
+      fp = cache_hash(fp, channelid_table[i].desc, strlen(channelid_table[i].desc) + 1);
     }
   }
-
-  fclose(fd_zap);
+  cache_open(cache_file, fp);
 } /*}}}*/
 
 /* Main function. {{{ */
@@ -843,22 +1117,68 @@ int main(int argc, char **argv) {
     ProgName++;
   /* Process command line arguments */
   do_options(argc, argv);
+  /* Open the default text encoding. */
+  xmlify_init();
   /* Load lookup tables. */
-  if (use_chanidents && load_lookup(&channelid_table, CHANIDENTS))
+  if (use_chanidents && (channelid_count = load_lookup(&channelid_table, CHANIDENTS)) < 0)
     fprintf(stderr, "Error loading %s, continuing.\n", CHANIDENTS);
+  if (channels_file == NULL)
+    channels_load(tune_file ? tune_file : CHANNELS_CONF);
+  if (cache_file)
+    openCache();
   if (!silent)
     fprintf(stderr, "\n");
 
-  printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  printf("<!DOCTYPE tv SYSTEM \"xmltv.dtd\">\n");
-  printf("<tv generator-info-name=\"dvb-epg-gen\">\n");
-  if (openInput() != 0) {
+  if (daemon_path) {
+    stats_start(); // the stage times, for the metrics command
+    daemon_start(daemon_path, writer, writeChannels);
+  } else {
+    output_init(direct_output);
+    writer->head();
+  }
+  if (device_count == 0)
+    add_device(demux);
+  int i, n = 0;
+  for (i = 0; i < device_count; i++)
+    if (tune_file ? (devices[i].frontend = tune_open(devices[i].path)) >= 0 :
+        openInput(&devices[i]) == 0)
+      devices[n++] = devices[i];
+  device_count = n;
+  if (n == 0) {
     fprintf(stderr, "Unable to get event data from multiplex.\n");
     exit(1);
   }
+  if (daemon_path)
+    for (i = 0; i < n; i++)
+      devices[i].timeout = 0; // read for as long as there is data
 
-  readZapInfo();
-  readEventTables();
+  if (decoders < 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    decoders = cpus > 1 ? (cpus > 9 ? 8 : cpus - 1) : 0; // leave one for reading
+  }
+  if (!daemon_path) {
+    output_flush(); // the head of the document comes first
+    output_hold(writeChannels, !tune_file); // and the channels, once the SDT is in, all of a sweep
+  }
+  if (decoders)
+    pipeline_start(decoders, n, decodeEIT);
+  if (n == 1 && tune_file) {
+    sweepDevice(&devices[0]);
+  } else if (n == 1) {
+    readEventTables(&devices[0]);
+  } else {
+    for (i = 0; i < n; i++)
+      if (pthread_create(&devices[i].thread, NULL, readerThread, &devices[i]) != 0) {
+        fprintf(stderr, "Unable to start reader thread\n");
+        exit(1);
+      }
+    for (i = 0; i < n; i++)
+      pthread_join(devices[i].thread, NULL);
+  }
+  if (decoders)
+    pipeline_stop();
+  if (daemon_path)
+    daemon_wait(); // the input ended, serve what there is
   finish_up();
 
   return 0;
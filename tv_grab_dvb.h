@@ -1,8 +1,14 @@
 #ifndef __tv_grab_dvd
 #define __tv_grab_dvd
 
+#include <stdio.h>
+#include <sys/types.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "epgrab.h"
 
 /* lookup.c */
 union lookup_key {
@@ -14,23 +20,220 @@ struct lookup_table {
 	char *desc;
 };
 
-extern char *lookup(const struct lookup_table *l, int id);
+extern char *lookup(const struct lookup_table *l, int n, int id);
 extern int load_lookup(struct lookup_table **l, const char *file);
 
-/* dvb_info_tables.c */
-extern const struct lookup_table description_table[];
-extern const struct lookup_table aspect_table[];
-extern const struct lookup_table audio_table[];
-extern const struct lookup_table crid_type_table[];
+/* dvb_info_tables.c, indexed directly */
+extern const char *const description_table[256];
+extern const char *const aspect_table[4];
+extern const char *const audio_table[256];
+extern const char *const crid_type_table[64];
 
 /* langidents.c */
-extern const struct lookup_table languageid_table[];
+extern const char *lookup_language(const char *code);
 
 /* crc32.c */
 extern uint32_t _dvb_crc32(const uint8_t *data, size_t len);
 
+/* events.c */
+enum event_state { EVENT_NEW, EVENT_SEEN, EVENT_UPDATED };
+extern enum event_state event_update(int onid, int sid, int eid, int ver, time_t stop);
+extern size_t events_expire(time_t before);
+extern bool event_known(int onid, int sid, int eid);
+
+/* sections.c */
+extern bool section_seen(const void *sec, size_t len);
+extern void section_mark(const void *sec, size_t len);
+extern bool sections_complete(const uint8_t *tables, int tsid); /* a bit per table_id, tsid -1 for all */
+extern int sections_services(const uint8_t *tables, int *complete, FILE *list);
+
+/* charsets.c */
+struct charset {
+	const char *name;
+	const uint16_t *map;             /* byte to Unicode, 0xFFFF if undefined */
+	const uint16_t (*diacritic)[96]; /* ISO 6937 0xC1-0xCF before 0x20-0x7F */
+};
+extern const struct charset charsets[];
+
+/* strbuf.c */
+struct strbuf {
+	char *buf;   /* NUL-terminated once anything was added */
+	size_t len;  /* bytes used, without the NUL */
+	size_t size; /* bytes allocated */
+};
+#define STRBUF_INIT { NULL, 0, 0 }
+extern void strbuf_grow(struct strbuf *sb, size_t extra);
+extern void strbuf_add(struct strbuf *sb, const void *data, size_t len);
+extern void strbuf_addf(struct strbuf *sb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern void strbuf_release(struct strbuf *sb);
+
+/* arena.c */
+struct arena_block;
+struct arena {
+	const char *name;          /* for memory_usage() */
+	struct arena_block *block; /* the current one, the others chained */
+	size_t used;               /* bytes handed out */
+	size_t reserved;           /* bytes obtained from malloc */
+	struct arena *next;        /* of all registered */
+	bool registered;
+};
+#define ARENA_INIT(name) { name, NULL, 0, 0, NULL, false }
+extern void *arena_alloc(struct arena *a, size_t n);
+extern void *arena_copy(struct arena *a, const void *data, size_t n);
+extern void arena_reset(struct arena *a);
+extern void arena_release(struct arena *a);
+extern void arena_swap(struct arena *a, struct arena *b);
+extern void arena_count(struct arena *a, size_t used, size_t reserved);
+extern void memory_usage(void (*fn)(const char *name, size_t used, size_t reserved, void *arg), void *arg);
+
+/* input.c */
+struct input {
+	int fd;
+	uint8_t *buf;
+	size_t len;  /* bytes in buf */
+	size_t pos;  /* bytes of them parsed */
+	size_t size; /* allocated, 0 if mapped */
+	bool mapped;
+	int64_t deadline; /* CLOCK_MONOTONIC ms, 0 for none */
+};
+extern int input_open(struct input *in, int fd, size_t size);
+extern void input_timeout(struct input *in, int seconds);
+extern ssize_t input_fill(struct input *in);
+extern ssize_t input_poll(struct input *in, int n, int *which);
+extern void input_close(struct input *in);
+
+/* tune.c */
+extern int tune_load(const char *file);
+extern int tune_open(const char *demux);
+extern int tune_next(int fe);
+extern void tune_done(void);
+extern int tune_progress(int *total);
+extern void tune_nit(const uint8_t *sec, size_t len);
+
+/* channels.c */
+extern int channels_load(const char *file);
+extern bool channels_sdt(int source, const uint8_t *sec, size_t len);
+extern void channels_list(void (*fn)(int sid, const char *name, int len));
+
+/* ts.c */
+typedef bool (*ts_section_cb)(int pid, const uint8_t *sec, size_t len);
+extern void ts_add_pid(int pid);
+extern int ts_detect(const uint8_t *buf, size_t len);
+extern size_t ts_feed(const uint8_t *buf, size_t len, ts_section_cb cb, bool *stop);
+
+/* dvbtime.c */
+extern size_t xmltv_time(char *buf, size_t size, time_t t);
+
+/* eit.c: an event decoded for the writers below, the fields in epgrab.h */
+struct programme {
+	const char *channel; /* XMLTV channel id */
+	int onid, tsid, sid, eid;
+	int running_status;
+	time_t start, stop;
+	unsigned types;      /* 1 << type of all fields */
+	int count;
+	struct epgrab_field field[4096]; /* in descriptor order, at most one per byte */
+};
+extern int eit_describe(struct programme *p, const void *descriptors, size_t len);
+
+/* xmltv.c, binary.c: output formats, appending to output */
+struct writer {
+	void (*head)(void);
+	void (*channel)(int sid, const char *id, const char *name, int len);
+	void (*programme)(const struct programme *p);
+	/* the removal of a programme written by an earlier run */
+	void (*removed)(struct strbuf *sb, const char *fragment, size_t len);
+	void (*tail)(void);
+};
+extern const struct writer xmltv_writer, binary_writer;
+
+/* output.c */
+extern __thread struct strbuf output; /* this thread's */
+#define out_lit(s) strbuf_add(&output, s, sizeof(s) - 1)
+#define out_printf(...) strbuf_addf(&output, __VA_ARGS__)
+extern void out_str(const char *s);
+extern void out_int(int i);
+extern void output_init(bool direct);
+extern void output_programmes(int n);
+extern void output_flush(void);
+extern void output_hold(void (*first)(void), bool bounded);
+extern void output_release(void);
+
+/* compress.c */
+extern bool compress_init(const char *spec);
+extern bool compress_enabled(void);
+extern void compress_data(struct strbuf *out, const void *data, size_t len, bool end);
+
+/* cache.c */
+enum cache_kind {
+	CACHE_EMPTY,     /* no descriptors */
+	CACHE_DATED,     /* outside the dates, not rendered */
+	CACHE_UNTITLED,  /* no title */
+	CACHE_PROGRAMME,
+};
+struct cache_event {
+	int64_t start;   /* time_t */
+	int64_t stop;
+	uint32_t text;   /* offset of the fragment */
+	uint32_t len;    /* of the fragment, 0 unless CACHE_PROGRAMME */
+	uint16_t eid;
+	uint8_t kind;
+	uint8_t pad;
+};
+extern uint32_t cache_hash(uint32_t h, const void *data, size_t len);
+extern void cache_open(const char *file, uint32_t fingerprint);
+extern const struct cache_event *cache_lookup(const void *sec, size_t len, int *count, const char **text);
+extern void cache_store(const void *sec, size_t len, const struct cache_event *ev, int count, const char *text, size_t text_len);
+extern size_t cache_programme(int onid, int sid, int eid, const char **text);
+extern void cache_removed(time_t now, void (*removed)(const char *text, size_t len));
+extern int cache_write(void);
+
+/* daemon.c */
+extern void daemon_start(const char *path, const struct writer *w, void (*channels)(void));
+extern void daemon_programme(const struct programme *p, bool now_next, const char *text, size_t len);
+extern void daemon_wait(void);
+
+/* sort.c */
+extern void sort_start(size_t budget);
+extern void sort_programme(int onid, int sid, int eid, time_t start, time_t stop, const char *text, size_t len);
+extern int sort_output(void);
+
+/* stats.c: counters of every thread, and the time spent in each stage */
+enum metric {
+	METRIC_PROGRAMMES,
+	METRIC_UPDATES,
+	METRIC_INVALID_DATES,
+	METRIC_REPEATS,        /* sections seen before */
+	METRIC_CRC_ERRORS,
+	METRIC_OVERFLOWS,      /* EOVERFLOW from the demux */
+	METRIC_TS_DISCONTINUITIES,
+	METRIC_TEXT,           /* strings converted by xmlify() */
+	METRIC_ICONV,          /* of them by iconv() */
+	METRIC_ICONV_FAILED,
+	METRICS
+};
+enum stage { STAGE_CRC, STAGE_DECODE, STAGE_TEXT, STAGE_OUTPUT, STAGES };
+extern void metric_add(enum metric m, int n);
+extern void metric_section(int table_id);
+extern uint64_t metric_total(enum metric m);
+extern uint64_t metric_sections(void);
+extern void stats_start(void);
+extern uint64_t stage_start(void);
+extern void stage_end(enum stage s, uint64_t start);
+extern void stats_report(FILE *f);
+extern void metrics_write(struct strbuf *sb, bool json);
+
+/* pipeline.c */
+typedef int (*pipeline_decode_fn)(void *sec, size_t len); /* to output */
+extern void pipeline_start(int workers, int sources, pipeline_decode_fn decode);
+extern void pipeline_submit(int source, const void *sec, size_t len);
+extern void pipeline_stop(void);
+
 /* dvb_text.c */
-extern char *xmlify(const char *s, int len);
+extern size_t xmlify(struct strbuf *out, const char *s, int len);
+extern int dvb_text(struct strbuf *out, const char *s, int len);
+extern void xmlify_init(void);
 extern char *iso6937_encoding;
 
 #endif
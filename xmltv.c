@@ -0,0 +1,292 @@
+/* xmltv.c: programmes as XMLTV, the default output format.
+ *
+ * xmltv.dtd wants the elements of a programme in its own order, which
+ * is not the order the descriptors come in, so the fields of a decoded
+ * event are walked once for each group of elements, see
+ * xmltv_programme().  Text is converted and quoted by xmlify() while
+ * it is appended. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tv_grab_dvb.h"
+
+/* Rounds of xmltv_programme(), each putting out some of the elements. */
+enum round {
+  R_TITLE,      // [title], unknown descriptors
+  R_SUB_TITLE,  // [sub-title]
+  R_DESC,       // [desc]
+  R_CATEGORY,   // [category]
+  R_LANGUAGE,   // [language]
+  R_VIDEO,      // [video], crid
+  R_AUDIO,      // [audio]
+  R_SUBTITLES,  // [subtitles] [rating]
+  ROUNDS
+};
+
+static const uint8_t field_rounds[] = {
+  [EPGRAB_TITLE] = 1 << R_TITLE,
+  [EPGRAB_UNKNOWN] = 1 << R_TITLE,
+  [EPGRAB_SUB_TITLE] = 1 << R_SUB_TITLE,
+  [EPGRAB_DESC] = 1 << R_DESC,
+  [EPGRAB_DESC_TEXT] = 1 << R_DESC,
+  [EPGRAB_DESC_END] = 1 << R_DESC,
+  [EPGRAB_CATEGORY] = 1 << R_CATEGORY,
+  [EPGRAB_COMPONENT] = 1 << R_LANGUAGE | 1 << R_VIDEO | 1 << R_AUDIO | 1 << R_SUBTITLES,
+  [EPGRAB_CRID] = 1 << R_VIDEO,
+  [EPGRAB_RATING] = 1 << R_SUBTITLES,
+};
+
+/* Parse language-id translation file. {{{ */
+static const char *xmllang(const char *l) {
+  static __thread char lang[4];
+  const char *c = lookup_language(l);
+  if (c)
+    return c;
+  memcpy(lang, l, 3);
+  return lang;
+} /*}}}*/
+
+static inline void out_text(const struct epgrab_field *f) {
+  xmlify(&output, f->text, f->len);
+}
+
+/* Title and sub-title. {{{ */
+static void xmltv_title(const struct epgrab_field *f) {
+  out_lit("\t<title lang=\"");
+  out_str(xmllang(f->lang));
+  out_lit("\">");
+  out_text(f);
+  out_lit("</title>\n");
+}
+
+static void xmltv_sub_title(const struct epgrab_field *f) {
+  size_t mark = output.len;
+  out_lit("\t<sub-title lang=\"");
+  out_str(xmllang(f->lang));
+  out_lit("\">");
+  if (xmlify(&output, f->text, f->len))
+    out_lit("</sub-title>\n");
+  else
+    output.len = mark; // nothing left after conversion
+} /*}}}*/
+
+/* Description, in parts from the extended event descriptors. {{{ */
+static void xmltv_desc(const struct epgrab_field *f) {
+  switch (f->type) {
+    case EPGRAB_DESC:
+      out_lit("\t<desc lang=\"");
+      out_str(xmllang(f->lang));
+      out_lit("\">");
+      break;
+    case EPGRAB_DESC_TEXT:
+      out_text(f);
+      if (f->code == ':')
+        out_lit(": ");
+      else if (f->code == ';')
+        out_lit("; ");
+      break;
+    case EPGRAB_DESC_END:
+      out_lit("</desc>\n");
+      break;
+  }
+} /*}}}*/
+
+/* Category from the content nibbles. {{{ */
+static void xmltv_category(const struct epgrab_field *f) {
+  const char *c = description_table[f->code];
+  if (c)
+    if (c[0]) {
+      out_lit("\t<category>");
+      out_str(c);
+      out_lit("</category>\n");
+    }
+#ifdef CATEGORY_UNKNOWN
+    else
+      out_printf("\t<!--category>%s %02X %02X</category-->\n", c+1, f->code, f->code2);
+  else
+    out_printf("\t<!--category>%02X %02X</category-->\n", f->code, f->code2);
+#endif
+} /*}}}*/
+
+/* Component, in the round of its element. {{{
+ * seen counts the components put out in this round, to ensure we only
+ * output the first one of each (XMLTV can't cope with more than one) */
+static void xmltv_component(const struct epgrab_field *f, enum round round, int *seen) {
+  switch (f->code) { // stream_content
+    case 0x01: // Video Info
+      if (round == R_VIDEO && !*seen) {
+        //if ((f->code2-1)&0x08) //HD TV
+        //if ((f->code2-1)&0x04) //30Hz else 25
+        out_lit("\t<video>\n\t\t<aspect>");
+        out_str(aspect_table[(f->code2-1) & 0x03]);
+        out_lit("</aspect>\n\t</video>\n");
+        (*seen)++;
+      }
+      break;
+    case 0x02: // Audio Info
+      if (round == R_AUDIO && !*seen) {
+        out_lit("\t<audio>\n\t\t<stereo>");
+        out_str(audio_table[f->code2]);
+        out_lit("</stereo>\n\t</audio>\n");
+        (*seen)++;
+      }
+      if (round == R_LANGUAGE) {
+        if (!*seen) {
+          out_lit("\t<language>");
+          out_str(xmllang(f->lang));
+          out_lit("</language>\n");
+        } else {
+          out_lit("\t<!--language>");
+          out_str(xmllang(f->lang));
+          out_lit("</language-->\n");
+        }
+        (*seen)++;
+      }
+      break;
+    case 0x03: // Teletext Info
+      if (round == R_SUBTITLES) {
+        // FIXME: is there a suitable XMLTV output for this?
+        // if ((f->code2)&0x10) //subtitles
+        // if ((f->code2)&0x20) //subtitles for hard of hearing
+        out_lit("\t<subtitles type=\"teletext\">\n\t\t<language>");
+        out_str(xmllang(f->lang));
+        out_lit("</language>\n\t</subtitles>\n");
+      }
+      break;
+      // case 0x04: // AC3 info
+  }
+} /*}}}*/
+
+/* Parental rating, only the age based ones. {{{ */
+static void xmltv_rating(const struct epgrab_field *f) {
+  switch (f->code) {
+    case 0x01 ... 0x0F:
+      out_lit("\t<rating system=\"dvb\">\n\t\t<value>");
+      out_int(f->code + 3);
+      out_lit("</value>\n\t</rating>\n");
+      break;
+    case 0x10 ... 0xFF: /*broadcaster defined*/
+      break;
+  }
+} /*}}}*/
+
+/* Content reference identifier. {{{ */
+static void xmltv_crid(const struct epgrab_field *f) {
+  char type_buf[32];
+  const char *type = crid_type_table[f->code];
+  if (type == NULL) {
+    type = type_buf;
+    sprintf(type_buf, "0x%2x", f->code);
+  }
+  out_lit("\t<crid type='");
+  out_str(type);
+  out_lit("'>");
+  out_text(f);
+  out_lit("</crid>\n");
+} /*}}}*/
+
+/* Write one programme. {{{
+ * Tags should be output in this order:
+
+ 'title', 'sub-title', 'desc', 'credits', 'date', 'category', 'language',
+ 'orig-language', 'length', 'icon', 'url', 'country', 'episode-num',
+ 'video', 'audio', 'previously-shown', 'premiere', 'last-chance',
+ 'new', 'subtitles', 'rating', 'star-rating'
+ */
+static void xmltv_programme(const struct programme *p) {
+  char date_strbuf[32];
+  unsigned rounds = 0;
+  int round, i;
+
+  out_lit("<programme channel=\"");
+  out_str(p->channel);
+  out_lit("\"");
+  out_lit(" start=\"");
+  strbuf_add(&output, date_strbuf, xmltv_time(date_strbuf, sizeof(date_strbuf), p->start));
+  out_lit("\" stop=\"");
+  strbuf_add(&output, date_strbuf, xmltv_time(date_strbuf, sizeof(date_strbuf), p->stop));
+  out_lit("\">\n ");
+
+  //printf("\t<EventID>%i</EventID>\n", p->eid);
+  //printf("\t<RunningStatus>%i</RunningStatus>\n", p->running_status);
+  //1 Airing, 2 Starts in a few seconds, 3 Pausing, 4 About to air
+
+  for (i = EPGRAB_TITLE; i <= EPGRAB_UNKNOWN; i++)
+    if (p->types & (1 << i))
+      rounds |= field_rounds[i];
+  for (round = 0; round < ROUNDS; round++) {
+    int seen = 0; // no language/video/audio seen in this round
+    if (!(rounds & (1 << round)))
+      continue;
+    for (i = 0; i < p->count; i++) {
+      const struct epgrab_field *f = &p->field[i];
+      if (!(field_rounds[f->type] & (1 << round)))
+        continue;
+      switch (f->type) {
+        case EPGRAB_TITLE:
+          xmltv_title(f);
+          break;
+        case EPGRAB_SUB_TITLE:
+          xmltv_sub_title(f);
+          break;
+        case EPGRAB_DESC:
+        case EPGRAB_DESC_TEXT:
+        case EPGRAB_DESC_END:
+          xmltv_desc(f);
+          break;
+        case EPGRAB_CATEGORY:
+          xmltv_category(f);
+          break;
+        case EPGRAB_COMPONENT:
+          xmltv_component(f, round, &seen);
+          break;
+        case EPGRAB_RATING:
+          xmltv_rating(f);
+          break;
+        case EPGRAB_CRID:
+          xmltv_crid(f);
+          break;
+        case EPGRAB_UNKNOWN:
+          out_printf("\t<!--Unknown_Please_Report ID=\"%x\" Len=\"%d\" -->\n", f->code, f->code2);
+          break;
+      }
+    }
+  }
+  out_lit("</programme>\n");
+} /*}}}*/
+
+/* Mark the removal of a programme output before. {{{
+ * Takes the channel, start and stop of its <programme> tag. */
+static void xmltv_removed(struct strbuf *sb, const char *text, size_t len) {
+  const char *end = memchr(text, '>', len);
+  if (len < sizeof("<programme") || end == NULL)
+    return;
+  strbuf_add(sb, "<removed", sizeof("<removed") - 1);
+  strbuf_add(sb, text + sizeof("<programme") - 1, end - text - (sizeof("<programme") - 1));
+  strbuf_add(sb, "/>\n", 3);
+} /*}}}*/
+
+static void xmltv_head(void) {
+  out_lit("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      "<!DOCTYPE tv SYSTEM \"xmltv.dtd\">\n"
+      "<tv generator-info-name=\"dvb-epg-gen\">\n");
+}
+
+static void xmltv_channel(int sid, const char *id, const char *name, int len) {
+  out_lit("<channel id=\"");
+  out_str(id);
+  out_lit("\">\n\t<display-name>");
+  xmlify(&output, name, len);
+  out_lit("</display-name>\n</channel>\n");
+}
+
+static void xmltv_tail(void) {
+  out_lit("</tv>\n");
+}
+
+const struct writer xmltv_writer = {
+  xmltv_head, xmltv_channel, xmltv_programme, xmltv_removed, xmltv_tail,
+};